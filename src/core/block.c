@@ -0,0 +1,141 @@
+#include "core/riscv.h"
+#include "core/block.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+block_cache_t *block_cache_create(riscv_word_t base, riscv_word_t size) {
+    block_cache_t *cache = calloc(1, sizeof(block_cache_t));
+    if (!cache) {
+        fprintf(stderr, "alloc block cache failed\n");
+        return cache;
+    }
+
+    cache->base = base;
+    cache->end = base + size;
+    cache->map = calloc(size >> 2, sizeof(block_t *));
+    cache->pages = calloc((size >> BLOCK_PAGE_SHIFT) + 1, sizeof(uint8_t));
+    if (!cache->map || !cache->pages) {
+        fprintf(stderr, "alloc block cache failed\n");
+        block_cache_free(cache);
+        return NULL;
+    }
+
+    return cache;
+}
+
+void block_cache_free(block_cache_t *cache) {
+    if (!cache) {
+        return;
+    }
+
+    block_invalidate(cache, cache->base, cache->end - cache->base);
+    block_free_retired(cache);
+    free(cache->map);
+    free(cache->pages);
+    free(cache);
+}
+
+// decode from pc up to and including the first instr that changes pc
+// ebreak and unknown encodings are left out so the caller stops in front of them
+block_t *block_translate(riscv_t *riscv, riscv_word_t pc) {
+    block_cache_t *cache = riscv->block_cache;
+    decoded_instr_t instrs[BLOCK_MAX_INSTRS];
+    int instr_num = 0;
+
+    riscv_word_t addr = pc;
+    while (instr_num < BLOCK_MAX_INSTRS && addr < cache->end) {
+        decoded_instr_t *instr = riscv_decode_at(riscv, addr);
+        if (instr->flags & DECODE_STOP) {
+            break;
+        }
+        // a breakpoint starts a block of its own, checked once at entry
+        if (instr_num > 0 && riscv->bp_list && riscv_detect_breakpoint(riscv, addr)) {
+            break;
+        }
+
+        instrs[instr_num++] = *instr;
+        addr += sizeof(riscv_word_t);
+        if (instr->flags & DECODE_JUMP) {
+            break;
+        }
+    }
+
+    if (instr_num == 0) {
+        return NULL;
+    }
+
+    block_t *block = malloc(sizeof(block_t) + instr_num * sizeof(decoded_instr_t));
+    if (!block) {
+        fprintf(stderr, "alloc block failed\n");
+        return NULL;
+    }
+    block->pc = pc;
+    block->instr_num = instr_num;
+    block->prof = NULL;
+    block->native = NULL;
+    block->guard_off = 0;
+    block->next = NULL;
+    memcpy(block->instrs, instrs, instr_num * sizeof(decoded_instr_t));
+    riscv_spin_block(riscv, block); // looks at the handlers before fusion replaces them
+    riscv_fuse_block(riscv, block);
+
+    cache->map[(pc - cache->base) >> 2] = block;
+    for (riscv_word_t page = (pc - cache->base) >> BLOCK_PAGE_SHIFT;
+         page <= (addr - 1 - cache->base) >> BLOCK_PAGE_SHIFT; page++) {
+        cache->pages[page] = 1;
+    }
+
+    return block;
+}
+
+// blocks are only retired here, the one running may be the one being written
+void block_invalidate(block_cache_t *cache, riscv_word_t addr, riscv_word_t size) {
+    if (!cache) {
+        return;
+    }
+
+    riscv_word_t start = addr < cache->base ? cache->base : addr;
+    riscv_word_t end = (addr + size > cache->end || addr + size < addr) ? cache->end : addr + size;
+    if (start >= end) {
+        return;
+    }
+
+    riscv_word_t first_page = (start - cache->base) >> BLOCK_PAGE_SHIFT;
+    riscv_word_t last_page = (end - 1 - cache->base) >> BLOCK_PAGE_SHIFT;
+    for (riscv_word_t page = first_page; page <= last_page; page++) {
+        if (!cache->pages[page]) {
+            continue;
+        }
+        cache->pages[page] = 0;
+
+        // a block covering this page starts at most BLOCK_MAX_INSTRS - 1 words before it
+        riscv_word_t page_start = page << BLOCK_PAGE_SHIFT;
+        riscv_word_t page_end = (page + 1) << BLOCK_PAGE_SHIFT;
+        riscv_word_t reach = (BLOCK_MAX_INSTRS - 1) * sizeof(riscv_word_t);
+        riscv_word_t from = page_start > reach ? page_start - reach : 0;
+        if (page_end > cache->end - cache->base) {
+            page_end = cache->end - cache->base;
+        }
+
+        for (riscv_word_t off = from; off < page_end; off += sizeof(riscv_word_t)) {
+            block_t *block = cache->map[off >> 2];
+            if (!block || off + block->instr_num * sizeof(riscv_word_t) <= page_start) {
+                continue;
+            }
+            cache->map[off >> 2] = NULL;
+            block->next = cache->retired;
+            cache->retired = block;
+        }
+    }
+}
+
+void block_free_retired(block_cache_t *cache) {
+    block_t *block = cache->retired;
+    while (block) {
+        block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    cache->retired = NULL;
+}
@@ -0,0 +1,47 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include "core/types.h"
+#include "core/instr.h"
+
+#define BLOCK_MAX_INSTRS    64
+#define BLOCK_PAGE_SHIFT    12 // invalidation granularity
+#define BLOCK_SPIN_MAX_INSTRS 8 // longest self loop looked at as a busy wait
+
+struct _riscv_t;
+struct _tier_prof_t;
+
+typedef void (*jit_fn_t)(struct _riscv_t *riscv);
+
+// straight-line run of decoded instrs, only the last one may change pc
+typedef struct _block_t {
+    riscv_word_t pc;
+    int instr_num;
+    struct _tier_prof_t *prof; // hotness and profile of the entry pc
+    jit_fn_t native;        // compiled code, runs the whole block and sets pc
+    uint8_t spin;           // busy wait, a lap of it only reads and branches back to pc
+    uint8_t spin_loads;     // bit per entry that is a load, checked before each skip
+    uint8_t guard_off;      // faulted in guard mode, mmio most likely, later runs skip the window
+    struct _block_t *next;  // retired list
+    decoded_instr_t instrs[];
+}block_t;
+
+typedef struct _block_cache_t {
+    riscv_word_t base;
+    riscv_word_t end;
+    block_t **map;      // one slot per flash word, indexed by block entry pc
+    uint8_t *pages;     // set if any block covers the page
+    block_t *retired;   // invalidated blocks, freed at the next block boundary
+}block_cache_t;
+
+block_cache_t *block_cache_create(riscv_word_t base, riscv_word_t size);
+void block_cache_free(block_cache_t *cache);
+block_t *block_translate(struct _riscv_t *riscv, riscv_word_t pc);
+void block_invalidate(block_cache_t *cache, riscv_word_t addr, riscv_word_t size);
+void block_free_retired(block_cache_t *cache);
+
+static inline block_t *block_find(block_cache_t *cache, riscv_word_t pc) {
+    return cache->map[(pc - cache->base) >> 2];
+}
+
+#endif
@@ -0,0 +1,122 @@
+#include "core/riscv.h"
+#include "core/guard.h"
+#include "device/mem.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#ifdef __linux__
+#include <signal.h>
+#include <sys/mman.h>
+#endif
+
+#ifdef __linux__
+static guard_t *guard_current; // one cpu per process
+
+// faults inside the window while the run loop is active go back to it, anything else crashes
+static void guard_handler(int sig, siginfo_t *info, void *ctx) {
+    guard_t *guard = guard_current;
+    uint8_t *addr = (uint8_t *)info->si_addr;
+    if (guard && guard->active && addr >= guard->window && addr < guard->window + GUARD_WINDOW_SIZE + GUARD_TAIL_SIZE) {
+        guard->active = 0;
+        siglongjmp(guard->fault_jmp, 1);
+    }
+
+    signal(sig, SIG_DFL); // refaults with the default action
+}
+
+guard_t *guard_create(riscv_t *riscv) {
+    guard_t *guard = calloc(1, sizeof(guard_t));
+    if (!guard) {
+        fprintf(stderr, "alloc guard failed\n");
+        return NULL;
+    }
+
+    guard->window = mmap(NULL, GUARD_WINDOW_SIZE + GUARD_TAIL_SIZE, PROT_NONE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (guard->window == MAP_FAILED) {
+        fprintf(stderr, "reserve guard window failed\n");
+        free(guard);
+        return NULL;
+    }
+
+    // unaligned or hugetlb regions stay holes and take the slow path
+    device_t *flash_dev = riscv->flash ? &riscv->flash->device : (device_t *)0;
+    for (device_t *device = riscv->device_list; device; device = device->next) {
+        if (!device->mem) {
+            continue;
+        }
+        int readable = device->attr & MEM_ATTR_READABLE;
+        int writable = (device->attr & MEM_ATTR_WRITABLE) && device != flash_dev; // stores flush decoded code
+        if (mem_alias((mem_t *)device, guard->window + device->base, readable, writable) < 0) {
+            fprintf(stderr, "%s can not be mapped into the guard window\n", device->name);
+        }
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = guard_handler;
+    sa.sa_flags = SA_SIGINFO | SA_NODEFER; // left by siglongjmp, must not stay blocked
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGSEGV, &sa, NULL);
+    sigaction(SIGBUS, &sa, NULL);
+
+    guard_current = guard;
+    return guard;
+}
+#else
+guard_t *guard_create(riscv_t *riscv) {
+    fprintf(stderr, "guard page mode is only supported on linux\n");
+    return NULL;
+}
+#endif
+
+// the same load/store loop with and without the guard window, interpreter only
+static const riscv_word_t guard_bench_code[] = {
+    0x00000437, // lui s0, ram_base
+    0x00000493, // addi s1, zero, 0
+    0x00400937, // lui s2, 0x400
+    0x00042283, // lw t0, 0(s0)
+    0x00442303, // lw t1, 4(s0)
+    0x006282b3, // add t0, t0, t1
+    0x00542423, // sw t0, 8(s0)
+    0x00944383, // lbu t2, 9(s0)
+    0x00741623, // sh t2, 12(s0)
+    0x00c42e03, // lw t3, 12(s0)
+    0x01c50533, // add a0, a0, t3
+    0x00148493, // addi s1, s1, 1
+    0xfd24cee3, // blt s1, s2, -40
+    0x00100073, // ebreak
+};
+
+static double guard_bench_run(riscv_t *riscv, guard_t *guard) {
+    riscv_reset(riscv);
+    riscv->pc = riscv->flash->device.base;
+    riscv->guard = guard;
+
+    clock_t start = clock();
+    riscv_fetch_and_execute(riscv, 1);
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+void guard_bench(riscv_t *riscv, riscv_word_t ram_base, FILE *file) {
+    riscv_word_t code[sizeof(guard_bench_code) / sizeof(guard_bench_code[0])];
+    memcpy(code, guard_bench_code, sizeof(code));
+    code[0] |= ram_base & 0xFFFFF000;
+    riscv_mem_write(riscv, riscv->flash->device.base, (uint8_t *)code, sizeof(code));
+
+    guard_t *guard = riscv->guard ? riscv->guard : guard_create(riscv);
+    jit_t *jit = riscv->jit;
+    riscv->jit = NULL;
+
+    double paged = guard_bench_run(riscv, NULL);
+    fprintf(file, "page table: %.3fs\n", paged);
+    if (guard) {
+        double guarded = guard_bench_run(riscv, guard);
+        fprintf(file, "guard window: %.3fs, %.1f%% saved, %llu faults\n", guarded,
+                paged > 0 ? 100.0 * (paged - guarded) / paged : 0.0, (unsigned long long)guard->faults);
+    }
+
+    riscv->jit = jit;
+    riscv->guard = guard;
+}
@@ -0,0 +1,27 @@
+#ifndef GUARD_H
+#define GUARD_H
+
+#include <stdio.h>
+#include <setjmp.h>
+#include "core/types.h"
+
+// the whole guest space as one host mapping, ram and flash aliased at their guest addresses
+// holes and mmio stay PROT_NONE and flash is read only, so those accesses fault
+#define GUARD_WINDOW_SIZE   (1ULL << 32)
+#define GUARD_TAIL_SIZE     (64 * 1024) // accesses straddling the top of the guest space
+
+struct _riscv_t;
+
+typedef struct _guard_t {
+    uint8_t *window;
+#ifdef __linux__
+    sigjmp_buf fault_jmp;   // set by the run loop, a faulting guest access lands here
+#endif
+    volatile int active;    // guest accesses through the window may be in flight
+    uint64_t faults;
+}guard_t;
+
+guard_t *guard_create(struct _riscv_t *riscv);
+void guard_bench(struct _riscv_t *riscv, riscv_word_t ram_base, FILE *file);
+
+#endif
@@ -5,6 +5,7 @@
 #include "core/riscv.h"
 
 #define EBREAK 0b00000000000100000000000001110011
+#define WFI    0b00010000010100000000000001110011
 
 #define OP_EBREAK_CSR 0b1110011
 #define OP_LUI     0b0110111
@@ -138,6 +139,7 @@
 #define FUNCT7_REMU      0b0000001
 #define FUNCT7_EBREAK    0b0000000
 #define FUNCT7_MRET      0b0011000
+#define FUNCT7_WFI       0b0001000
 
 #define IMM7_SRLI 0b0000000
 #define IMM7_SRAI 0b0100000
@@ -203,4 +205,38 @@ typedef union _instr_t {
     riscv_word_t raw;
 }instr_t;
 
+#define DECODE_STOP (1 << 0) // ebreak or unknown encoding, leave the loop without executing
+#define DECODE_JUMP (1 << 1) // handler sets pc itself
+#define DECODE_FUSED (1 << 2) // block entry whose handler also executes the next entry
+
+struct _riscv_t;
+struct _decoded_instr_t;
+typedef void (*exec_fn_t)(struct _riscv_t *riscv, const struct _decoded_instr_t *instr);
+
+// instruction after decoding, the handler advances pc
+// imm is already sign extended (zero extended csr address for csr instrs)
+typedef struct _decoded_instr_t {
+    exec_fn_t exec;
+    uint8_t rd;
+    uint8_t rs1;
+    uint8_t rs2;
+    uint8_t flags;
+    int32_t imm;
+}decoded_instr_t;
+
+// idiom pairs executed as one block entry
+#define FUSE_LUI_ADDI       0 // li with a 32 bit constant
+#define FUSE_AUIPC_JALR     1 // far call or tail call
+#define FUSE_AUIPC_ADDI     2 // la, pc relative address
+#define FUSE_AUIPC_LW       3 // pc relative load
+#define FUSE_LUI_LW         4 // absolute load, mostly mmio
+#define FUSE_LUI_SW         5 // absolute store, mostly mmio
+#define FUSE_CMP_BRANCH     6 // slt(i)(u) followed by beqz/bnez on its result
+#define FUSE_NUM            7
+
+typedef struct _fuse_stats_t {
+    uint64_t sites[FUSE_NUM];   // pairs fused in translated blocks
+    uint64_t runs[FUSE_NUM];    // fused pairs executed
+}fuse_stats_t;
+
 #endif
\ No newline at end of file
@@ -0,0 +1,25 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "core/types.h"
+#include "core/block.h"
+
+#define JIT_HOT_THRESHOLD   64  // threaded runs of a block between compile attempts
+#define JIT_CODE_SIZE       (16 * 1024 * 1024)
+
+struct _riscv_t;
+
+typedef struct _jit_t {
+    uint8_t *code;          // executable region, blocks are bump allocated
+    uint32_t code_size;
+    uint32_t code_used;
+    riscv_word_t ram_base;  // loads and stores in [ram_base, ram_end) are emitted inline
+    riscv_word_t ram_end;
+    uint8_t *ram_mem;
+    uint32_t block_num;
+}jit_t;
+
+jit_t *jit_create(struct _riscv_t *riscv);
+jit_fn_t jit_compile(jit_t *jit, struct _riscv_t *riscv, block_t *block);
+
+#endif
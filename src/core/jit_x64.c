@@ -0,0 +1,681 @@
+#include "core/riscv.h"
+#include "core/jit.h"
+#include "device/mem.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#include <sys/mman.h>
+
+// host regs, in x86 encoding order
+enum {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+// condition codes for jcc/setcc/cmovcc
+#define CC_B    0x2
+#define CC_AE   0x3
+#define CC_E    0x4
+#define CC_NE   0x5
+#define CC_L    0xC
+#define CC_GE   0xD
+
+// callee saved, so guest regs cached in them survive helper calls
+// rbx holds the riscv_t pointer
+#define JIT_HOST_REGS_NUM 5
+static const int host_regs[JIT_HOST_REGS_NUM] = {RBP, R12, R13, R14, R15};
+
+#define JIT_INSTR_MAX_BYTES 256 // worst case code size for one guest instr
+
+#define REG_OFF(reg) ((int32_t)(offsetof(riscv_t, regs) + (reg) * sizeof(riscv_word_t)))
+#define PC_OFF ((int32_t)offsetof(riscv_t, pc))
+
+typedef struct _emit_t {
+    uint8_t *ptr;
+    int host_reg[RISCV_REGS_NUM]; // host reg caching a guest reg, -1 if it lives in riscv_t
+    uint32_t dirty;               // cached guest regs not yet written back
+}emit_t;
+
+static inline void emit8(emit_t *e, uint8_t val) {
+    *e->ptr++ = val;
+}
+
+static inline void emit32(emit_t *e, uint32_t val) {
+    memcpy(e->ptr, &val, sizeof(val));
+    e->ptr += sizeof(val);
+}
+
+static inline void emit64(emit_t *e, uint64_t val) {
+    memcpy(e->ptr, &val, sizeof(val));
+    e->ptr += sizeof(val);
+}
+
+static void emit_rex(emit_t *e, int w, int reg, int index, int rm) {
+    uint8_t rex = 0x40 | (w << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (rm >> 3);
+    if (rex != 0x40) {
+        emit8(e, rex);
+    }
+}
+
+// op r/m, reg with both operands registers
+static void emit_rr(emit_t *e, int w, uint8_t op, int reg, int rm) {
+    emit_rex(e, w, reg, 0, rm);
+    emit8(e, op);
+    emit8(e, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// two byte opcode 0F op, both operands registers
+static void emit_rr_0f(emit_t *e, int w, uint8_t op, int reg, int rm) {
+    emit_rex(e, w, reg, 0, rm);
+    emit8(e, 0x0F);
+    emit8(e, op);
+    emit8(e, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// op reg, [rbx + disp32], rbx is the riscv_t pointer
+static void emit_riscv_field(emit_t *e, uint8_t op, int reg, int32_t disp) {
+    emit_rex(e, 0, reg, 0, RBX);
+    emit8(e, op);
+    emit8(e, 0x80 | ((reg & 7) << 3) | RBX);
+    emit32(e, disp);
+}
+
+static void emit_mov_imm32(emit_t *e, int reg, uint32_t imm) {
+    emit_rex(e, 0, 0, 0, reg);
+    emit8(e, 0xB8 | (reg & 7));
+    emit32(e, imm);
+}
+
+static void emit_mov_imm64(emit_t *e, int reg, uint64_t imm) {
+    emit_rex(e, 1, 0, 0, reg);
+    emit8(e, 0xB8 | (reg & 7));
+    emit64(e, imm);
+}
+
+// 81 /ext: add 0, or 1, and 4, sub 5, xor 6, cmp 7
+static void emit_alu_imm32(emit_t *e, int ext, int reg, uint32_t imm) {
+    emit_rex(e, 0, 0, 0, reg);
+    emit8(e, 0x81);
+    emit8(e, 0xC0 | (ext << 3) | (reg & 7));
+    emit32(e, imm);
+}
+
+// C1 /ext: shl 4, shr 5, sar 7
+static void emit_shift_imm(emit_t *e, int w, int ext, int reg, uint8_t imm) {
+    emit_rex(e, w, 0, 0, reg);
+    emit8(e, 0xC1);
+    emit8(e, 0xC0 | (ext << 3) | (reg & 7));
+    emit8(e, imm);
+}
+
+// D3 /ext, shift count in cl
+static void emit_shift_cl(emit_t *e, int ext, int reg) {
+    emit_rex(e, 0, 0, 0, reg);
+    emit8(e, 0xD3);
+    emit8(e, 0xC0 | (ext << 3) | (reg & 7));
+}
+
+// setcc al; movzx eax, al
+static void emit_setcc_eax(emit_t *e, int cc) {
+    emit8(e, 0x0F);
+    emit8(e, 0x90 | cc);
+    emit8(e, 0xC0);
+    emit_rr_0f(e, 0, 0xB6, RAX, RAX);
+}
+
+// op reg, [rdx + r8], rdx holds the host base of guest ram
+static void emit_ram_access(emit_t *e, int prefix16, const uint8_t *op, int op_len, int reg) {
+    if (prefix16) {
+        emit8(e, 0x66);
+    }
+    emit_rex(e, 0, reg, R8, RDX);
+    for (int i = 0; i < op_len; i++) {
+        emit8(e, op[i]);
+    }
+    emit8(e, 0x04 | ((reg & 7) << 3)); // mod 00, rm 100 (sib)
+    emit8(e, ((R8 & 7) << 3) | RDX);   // scale 1, index r8, base rdx
+}
+
+static void emit_call(emit_t *e, void *func) {
+    emit_mov_imm64(e, RAX, (uint64_t)(uintptr_t)func);
+    emit8(e, 0xFF);
+    emit8(e, 0xD0); // call rax
+}
+
+// jcc rel32 with the target patched later, returns the rel32 field
+static uint8_t *emit_jcc(emit_t *e, int cc) {
+    emit8(e, 0x0F);
+    emit8(e, 0x80 | cc);
+    uint8_t *rel = e->ptr;
+    emit32(e, 0);
+    return rel;
+}
+
+static uint8_t *emit_jmp(emit_t *e) {
+    emit8(e, 0xE9);
+    uint8_t *rel = e->ptr;
+    emit32(e, 0);
+    return rel;
+}
+
+static void patch_rel32(uint8_t *rel, uint8_t *target) {
+    int32_t off = (int32_t)(target - (rel + sizeof(int32_t)));
+    memcpy(rel, &off, sizeof(off));
+}
+
+static void load_guest(emit_t *e, int host, int guest) {
+    if (guest == 0) {
+        emit_rr(e, 0, 0x31, host, host); // xor host, host
+        return;
+    }
+
+    int cached = e->host_reg[guest];
+    if (cached >= 0) {
+        emit_rr(e, 0, 0x89, cached, host); // mov host, cached
+    } else {
+        emit_riscv_field(e, 0x8B, host, REG_OFF(guest));
+    }
+}
+
+static void store_guest(emit_t *e, int guest, int host) {
+    if (guest == 0) {
+        return;
+    }
+
+    int cached = e->host_reg[guest];
+    if (cached >= 0) {
+        emit_rr(e, 0, 0x89, host, cached); // mov cached, host
+        e->dirty |= 1u << guest;
+    } else {
+        emit_riscv_field(e, 0x89, host, REG_OFF(guest));
+    }
+}
+
+static void spill_guest_regs(emit_t *e) {
+    for (int guest = 1; guest < RISCV_REGS_NUM; guest++) {
+        if (e->dirty & (1u << guest)) {
+            emit_riscv_field(e, 0x89, e->host_reg[guest], REG_OFF(guest));
+        }
+    }
+    e->dirty = 0;
+}
+
+static void reload_guest_regs(emit_t *e) {
+    for (int guest = 1; guest < RISCV_REGS_NUM; guest++) {
+        if (e->host_reg[guest] >= 0) {
+            emit_riscv_field(e, 0x8B, e->host_reg[guest], REG_OFF(guest));
+        }
+    }
+}
+
+static void emit_prologue(emit_t *e) {
+    emit8(e, 0x53);         // push rbx
+    emit8(e, 0x55);         // push rbp
+    emit8(e, 0x41);
+    emit8(e, 0x54);         // push r12
+    emit8(e, 0x41);
+    emit8(e, 0x55);         // push r13
+    emit8(e, 0x41);
+    emit8(e, 0x56);         // push r14
+    emit8(e, 0x41);
+    emit8(e, 0x57);         // push r15
+    emit8(e, 0x48);
+    emit8(e, 0x83);
+    emit8(e, 0xEC);
+    emit8(e, 0x08);         // sub rsp, 8 to keep calls 16 byte aligned
+    emit_rr(e, 1, 0x89, RDI, RBX); // mov rbx, rdi
+    reload_guest_regs(e);
+}
+
+static void emit_epilogue(emit_t *e) {
+    spill_guest_regs(e);
+    emit8(e, 0x48);
+    emit8(e, 0x83);
+    emit8(e, 0xC4);
+    emit8(e, 0x08);         // add rsp, 8
+    emit8(e, 0x41);
+    emit8(e, 0x5F);         // pop r15
+    emit8(e, 0x41);
+    emit8(e, 0x5E);         // pop r14
+    emit8(e, 0x41);
+    emit8(e, 0x5D);         // pop r13
+    emit8(e, 0x41);
+    emit8(e, 0x5C);         // pop r12
+    emit8(e, 0x5D);         // pop rbp
+    emit8(e, 0x5B);         // pop rbx
+    emit8(e, 0xC3);         // ret
+}
+
+static riscv_word_t jit_mem_read(riscv_t *riscv, riscv_word_t addr, int width) {
+    if (width == 4) {
+        return riscv_mem_read32(riscv, addr);
+    } else if (width == 2) {
+        return riscv_mem_read16(riscv, addr);
+    }
+    return riscv_mem_read8(riscv, addr);
+}
+
+static void jit_mem_write(riscv_t *riscv, riscv_word_t addr, riscv_word_t val, int width) {
+    if (width == 4) {
+        riscv_mem_write32(riscv, addr, val);
+    } else if (width == 2) {
+        riscv_mem_write16(riscv, addr, val);
+    } else {
+        riscv_mem_write8(riscv, addr, val);
+    }
+}
+
+// anything without a native form (csr, mret, div/rem) runs its interpreter handler
+// returns 1 if the handler has set pc and the block must end here
+static int emit_fallback(emit_t *e, decoded_instr_t *instr, riscv_word_t pc) {
+    spill_guest_regs(e);
+    emit_mov_imm32(e, RAX, pc);
+    emit_riscv_field(e, 0x89, RAX, PC_OFF);
+    emit_rr(e, 1, 0x89, RBX, RDI);
+    emit_mov_imm64(e, RSI, (uint64_t)(uintptr_t)instr);
+    emit_call(e, (void *)instr->exec);
+    reload_guest_regs(e);
+    return (instr->flags & DECODE_JUMP) ? 1 : 0;
+}
+
+// address in ecx, loaded value ends up in eax
+static void emit_load(emit_t *e, jit_t *jit, int width, int is_signed) {
+    static const uint8_t op_lb[] = {0x0F, 0xBE}, op_lbu[] = {0x0F, 0xB6};
+    static const uint8_t op_lh[] = {0x0F, 0xBF}, op_lhu[] = {0x0F, 0xB7};
+    static const uint8_t op_lw[] = {0x8B};
+
+    uint8_t *to_slow = NULL, *to_done = NULL;
+    if (jit->ram_mem) {
+        emit_rr(e, 0, 0x89, RCX, R8);                                   // mov r8d, ecx
+        emit_alu_imm32(e, 5, R8, jit->ram_base);                        // sub r8d, ram_base
+        emit_alu_imm32(e, 7, R8, jit->ram_end - jit->ram_base - width + 1);
+        to_slow = emit_jcc(e, CC_AE);
+        emit_mov_imm64(e, RDX, (uint64_t)(uintptr_t)jit->ram_mem);
+        if (width == 1) {
+            emit_ram_access(e, 0, is_signed ? op_lb : op_lbu, 2, RAX);
+        } else if (width == 2) {
+            emit_ram_access(e, 0, is_signed ? op_lh : op_lhu, 2, RAX);
+        } else {
+            emit_ram_access(e, 0, op_lw, 1, RAX);
+        }
+        to_done = emit_jmp(e);
+        patch_rel32(to_slow, e->ptr);
+    }
+
+    emit_rr(e, 0, 0x89, RCX, RSI);      // mov esi, ecx
+    emit_mov_imm32(e, RDX, width);
+    emit_rr(e, 1, 0x89, RBX, RDI);      // mov rdi, rbx
+    emit_call(e, (void *)jit_mem_read);
+    if (is_signed && width == 1) {
+        emit_rr_0f(e, 0, 0xBE, RAX, RAX); // movsx eax, al
+    } else if (is_signed && width == 2) {
+        emit_rr_0f(e, 0, 0xBF, RAX, RAX); // movsx eax, ax
+    }
+
+    if (to_done) {
+        patch_rel32(to_done, e->ptr);
+    }
+}
+
+// address in ecx, value in eax
+static void emit_store(emit_t *e, jit_t *jit, int width) {
+    static const uint8_t op_sb[] = {0x88}, op_sw[] = {0x89};
+
+    uint8_t *to_slow = NULL, *to_done = NULL;
+    if (jit->ram_mem) {
+        emit_rr(e, 0, 0x89, RCX, R8);
+        emit_alu_imm32(e, 5, R8, jit->ram_base);
+        emit_alu_imm32(e, 7, R8, jit->ram_end - jit->ram_base - width + 1);
+        to_slow = emit_jcc(e, CC_AE);
+        emit_mov_imm64(e, RDX, (uint64_t)(uintptr_t)jit->ram_mem);
+        emit_ram_access(e, width == 2, width == 1 ? op_sb : op_sw, 1, RAX);
+        to_done = emit_jmp(e);
+        patch_rel32(to_slow, e->ptr);
+    }
+
+    emit_rr(e, 0, 0x89, RCX, RSI);      // mov esi, ecx
+    emit_rr(e, 0, 0x89, RAX, RDX);      // mov edx, eax
+    emit_mov_imm32(e, RCX, width);
+    emit_rr(e, 1, 0x89, RBX, RDI);      // mov rdi, rbx
+    emit_call(e, (void *)jit_mem_write);
+
+    if (to_done) {
+        patch_rel32(to_done, e->ptr);
+    }
+}
+
+static void emit_i_arith_shift_instr(emit_t *e, instr_t *raw, decoded_instr_t *instr) {
+    load_guest(e, RAX, instr->rs1);
+    switch (raw->i.funct3) {
+    case FUNCT3_ADDI:
+        emit_alu_imm32(e, 0, RAX, instr->imm);
+        break;
+    case FUNCT3_ORI:
+        emit_alu_imm32(e, 1, RAX, instr->imm);
+        break;
+    case FUNCT3_ANDI:
+        emit_alu_imm32(e, 4, RAX, instr->imm);
+        break;
+    case FUNCT3_XORI:
+        emit_alu_imm32(e, 6, RAX, instr->imm);
+        break;
+    case FUNCT3_SLTI:
+        emit_alu_imm32(e, 7, RAX, instr->imm);
+        emit_setcc_eax(e, CC_L);
+        break;
+    case FUNCT3_SLTIU:
+        emit_alu_imm32(e, 7, RAX, instr->imm);
+        emit_setcc_eax(e, CC_B);
+        break;
+    case FUNCT3_SLLI:
+        emit_shift_imm(e, 0, 4, RAX, instr->imm & 0x1F);
+        break;
+    case FUNCT3_SRLI_SRAI:
+        emit_shift_imm(e, 0, (raw->i.imm_11_0 >> 5) == IMM7_SRAI ? 7 : 5, RAX, instr->imm & 0x1F);
+        break;
+    }
+    store_guest(e, instr->rd, RAX);
+}
+
+// returns -1 for div/rem, they go through the interpreter handler
+static int emit_r_instr(emit_t *e, instr_t *raw, decoded_instr_t *instr) {
+    riscv_word_t funct3 = raw->r.funct3;
+    int is_m = raw->r.funct7 == FUNCT7_MUL;
+    if (is_m && funct3 >= FUNCT3_DIV) {
+        return -1;
+    }
+
+    load_guest(e, RAX, instr->rs1);
+    load_guest(e, RCX, instr->rs2);
+    if (is_m) {
+        switch (funct3) {
+        case FUNCT3_ADD_SUB_MUL:
+            emit_rr_0f(e, 0, 0xAF, RAX, RCX);       // imul eax, ecx
+            break;
+        case FUNCT3_SLL_MULH:
+            emit_rr(e, 1, 0x63, RAX, RAX);          // movsxd rax, eax
+            emit_rr(e, 1, 0x63, RCX, RCX);          // movsxd rcx, ecx
+            emit_rr_0f(e, 1, 0xAF, RAX, RCX);       // imul rax, rcx
+            emit_shift_imm(e, 1, 7, RAX, 32);       // sar rax, 32
+            break;
+        case FUNCT3_SLT_MULHSU:
+            emit_rr(e, 1, 0x63, RAX, RAX);
+            emit_rr_0f(e, 1, 0xAF, RAX, RCX);
+            emit_shift_imm(e, 1, 7, RAX, 32);
+            break;
+        case FUNCT3_SLTU_MULU:
+            emit_rr_0f(e, 1, 0xAF, RAX, RCX);       // both zero extended by the 32 bit loads
+            emit_shift_imm(e, 1, 5, RAX, 32);       // shr rax, 32
+            break;
+        }
+    } else {
+        switch (funct3) {
+        case FUNCT3_ADD_SUB_MUL:
+            emit_rr(e, 0, raw->r.funct7 == FUNCT7_SUB ? 0x29 : 0x01, RCX, RAX);
+            break;
+        case FUNCT3_SLL_MULH:
+            emit_shift_cl(e, 4, RAX);               // x86 masks the count to 5 bits as rv32 does
+            break;
+        case FUNCT3_SLT_MULHSU:
+            emit_rr(e, 0, 0x39, RCX, RAX);          // cmp eax, ecx
+            emit_setcc_eax(e, CC_L);
+            break;
+        case FUNCT3_SLTU_MULU:
+            emit_rr(e, 0, 0x39, RCX, RAX);
+            emit_setcc_eax(e, CC_B);
+            break;
+        case FUNCT3_XOR_DIV:
+            emit_rr(e, 0, 0x31, RCX, RAX);
+            break;
+        case FUNCT3_SRL_SRA_DIVU:
+            emit_shift_cl(e, raw->r.funct7 == FUNCT7_SRA ? 7 : 5, RAX);
+            break;
+        case FUNCT3_OR_REM:
+            emit_rr(e, 0, 0x09, RCX, RAX);
+            break;
+        case FUNCT3_AND_REMU:
+            emit_rr(e, 0, 0x21, RCX, RAX);
+            break;
+        }
+    }
+    store_guest(e, instr->rd, RAX);
+    return 0;
+}
+
+static void emit_branch(emit_t *e, instr_t *raw, decoded_instr_t *instr, riscv_word_t pc) {
+    int cc = CC_E;
+    switch (raw->b.funct3) {
+    case FUNCT3_BEQ:
+        cc = CC_E;
+        break;
+    case FUNCT3_BNE:
+        cc = CC_NE;
+        break;
+    case FUNCT3_BLT:
+        cc = CC_L;
+        break;
+    case FUNCT3_BGE:
+        cc = CC_GE;
+        break;
+    case FUNCT3_BLTU:
+        cc = CC_B;
+        break;
+    case FUNCT3_BGEU:
+        cc = CC_AE;
+        break;
+    }
+
+    load_guest(e, RAX, instr->rs1);
+    load_guest(e, RCX, instr->rs2);
+    emit_mov_imm32(e, RDX, pc + sizeof(riscv_word_t));
+    emit_mov_imm32(e, R8, pc + instr->imm);
+    emit_rr(e, 0, 0x39, RCX, RAX);          // cmp eax, ecx
+    emit_rr_0f(e, 0, 0x40 | cc, RDX, R8);   // cmovcc edx, r8d
+    emit_riscv_field(e, 0x89, RDX, PC_OFF);
+}
+
+// returns 1 if the instr ended the block by setting pc
+static int emit_instr(emit_t *e, jit_t *jit, decoded_instr_t *instr, riscv_word_t raw_word, riscv_word_t pc) {
+    instr_t raw;
+    raw.raw = raw_word;
+
+    switch (raw.opcode) {
+    case OP_LUI:
+        emit_mov_imm32(e, RAX, instr->imm);
+        store_guest(e, instr->rd, RAX);
+        return 0;
+    case OP_AUIPC:
+        emit_mov_imm32(e, RAX, pc + instr->imm);
+        store_guest(e, instr->rd, RAX);
+        return 0;
+    case OP_JAL:
+        emit_mov_imm32(e, RAX, pc + sizeof(riscv_word_t));
+        store_guest(e, instr->rd, RAX);
+        emit_mov_imm32(e, RAX, pc + instr->imm);
+        emit_riscv_field(e, 0x89, RAX, PC_OFF);
+        return 1;
+    case OP_JALR:
+        load_guest(e, RCX, instr->rs1);
+        emit_alu_imm32(e, 0, RCX, instr->imm);  // target before rd is written, rd may be rs1
+        emit_mov_imm32(e, RAX, pc + sizeof(riscv_word_t));
+        store_guest(e, instr->rd, RAX);
+        emit_riscv_field(e, 0x89, RCX, PC_OFF);
+        return 1;
+    case OP_B_INSTR:
+        emit_branch(e, &raw, instr, pc);
+        return 1;
+    case OP_I_ARITH_SHIFT_INSTR:
+        emit_i_arith_shift_instr(e, &raw, instr);
+        return 0;
+    case OP_R_INSTR:
+        if (emit_r_instr(e, &raw, instr) < 0) {
+            return emit_fallback(e, instr, pc);
+        }
+        return 0;
+    case OP_I_LOAD_INSTR:
+        load_guest(e, RCX, instr->rs1);
+        emit_alu_imm32(e, 0, RCX, instr->imm);
+        switch (raw.i.funct3) {
+        case FUNCT3_LB:
+            emit_load(e, jit, 1, 1);
+            break;
+        case FUNCT3_LBU:
+            emit_load(e, jit, 1, 0);
+            break;
+        case FUNCT3_LH:
+            emit_load(e, jit, 2, 1);
+            break;
+        case FUNCT3_LHU:
+            emit_load(e, jit, 2, 0);
+            break;
+        default:
+            emit_load(e, jit, 4, 0);
+            break;
+        }
+        store_guest(e, instr->rd, RAX);
+        return 0;
+    case OP_S_INSTR:
+        load_guest(e, RCX, instr->rs1);
+        emit_alu_imm32(e, 0, RCX, instr->imm);
+        load_guest(e, RAX, instr->rs2);
+        switch (raw.s.funct3) {
+        case FUNCT3_SB:
+            emit_store(e, jit, 1);
+            break;
+        case FUNCT3_SH:
+            emit_store(e, jit, 2);
+            break;
+        default:
+            emit_store(e, jit, 4);
+            break;
+        }
+        return 0;
+    default:
+        return emit_fallback(e, instr, pc);
+    }
+}
+
+// cache the most used guest regs of the block in callee saved host regs
+static void alloc_guest_regs(emit_t *e, block_t *block) {
+    int uses[RISCV_REGS_NUM] = {0};
+    for (int i = 0; i < block->instr_num; i++) {
+        uses[block->instrs[i].rd]++;
+        uses[block->instrs[i].rs1]++;
+        uses[block->instrs[i].rs2]++;
+    }
+
+    for (int guest = 0; guest < RISCV_REGS_NUM; guest++) {
+        e->host_reg[guest] = -1;
+    }
+    e->dirty = 0;
+
+    for (int i = 0; i < JIT_HOST_REGS_NUM; i++) {
+        int best = 0;
+        for (int guest = 1; guest < RISCV_REGS_NUM; guest++) {
+            if (e->host_reg[guest] < 0 && uses[guest] > uses[best]) {
+                best = guest;
+            }
+        }
+        if (best == 0 || uses[best] < 2) {
+            break;
+        }
+        e->host_reg[best] = host_regs[i];
+        uses[best] = 0;
+    }
+}
+
+// drop all compiled code, only called between blocks so none of it is running
+static void jit_flush(jit_t *jit, riscv_t *riscv) {
+    block_cache_t *cache = riscv->block_cache;
+    for (riscv_word_t i = 0; i < (cache->end - cache->base) >> 2; i++) {
+        if (cache->map[i]) {
+            cache->map[i]->native = NULL;
+        }
+    }
+    jit->code_used = 0;
+    jit->block_num = 0;
+}
+
+jit_t *jit_create(riscv_t *riscv) {
+    jit_t *jit = calloc(1, sizeof(jit_t));
+    if (!jit) {
+        fprintf(stderr, "alloc jit failed\n");
+        return jit;
+    }
+
+    jit->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code == MAP_FAILED) {
+        fprintf(stderr, "map jit code region failed, using interpreter\n");
+        free(jit);
+        return NULL;
+    }
+    jit->code_size = JIT_CODE_SIZE;
+
+    // the first readable and writable memory other than flash is treated as ram
+    // flash stores must go through riscv_mem_write to invalidate translated code
+    for (device_t *device = riscv->device_list; device; device = device->next) {
+        if (device->read != mem_read || device == &riscv->flash->device || (device->attr & MEM_ATTR_DEVICE)) {
+            continue;
+        }
+        if ((device->attr & MEM_ATTR_READABLE) && (device->attr & MEM_ATTR_WRITABLE)) {
+            jit->ram_base = device->base;
+            jit->ram_end = device->end;
+            jit->ram_mem = ((mem_t *)device)->mem;
+            break;
+        }
+    }
+
+    return jit;
+}
+
+jit_fn_t jit_compile(jit_t *jit, riscv_t *riscv, block_t *block) {
+    uint32_t worst = (block->instr_num + 2) * JIT_INSTR_MAX_BYTES;
+    if (worst > jit->code_size) {
+        return NULL;
+    }
+    if (jit->code_used + worst > jit->code_size) {
+        jit_flush(jit, riscv);
+    }
+
+    emit_t e;
+    e.ptr = jit->code + jit->code_used;
+    alloc_guest_regs(&e, block);
+
+    uint8_t *entry = e.ptr;
+    emit_prologue(&e);
+
+    riscv_word_t *flash = (riscv_word_t *)riscv->flash->mem;
+    riscv_word_t flash_base = riscv->flash->device.base;
+    riscv_word_t pc = block->pc;
+    int ended = 0;
+    for (int i = 0; i < block->instr_num && !ended; i++, pc += sizeof(riscv_word_t)) {
+        ended = emit_instr(&e, jit, &block->instrs[i], flash[(pc - flash_base) >> 2], pc);
+    }
+
+    if (!ended) {
+        emit_mov_imm32(&e, RAX, pc);
+        emit_riscv_field(&e, 0x89, RAX, PC_OFF);
+    }
+    emit_epilogue(&e);
+
+    jit->code_used = (uint32_t)(e.ptr - jit->code + 15) & ~15u;
+    jit->block_num++;
+    return (jit_fn_t)entry;
+}
+
+#else
+
+jit_t *jit_create(riscv_t *riscv) {
+    fprintf(stderr, "jit is only supported on x86-64 hosts, using interpreter\n");
+    return NULL;
+}
+
+jit_fn_t jit_compile(jit_t *jit, riscv_t *riscv, block_t *block) {
+    return NULL;
+}
+
+#endif
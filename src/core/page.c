@@ -0,0 +1,42 @@
+#include "core/page.h"
+#include "device/mem.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+// pages are only direct when the device covers them whole
+void page_table_map(page_table_t *table, device_t *device, int writable) {
+    if (device->end <= device->base) {
+        return;
+    }
+
+    riscv_word_t first = device->base >> PAGE_SHIFT;
+    riscv_word_t last = (device->end - 1) >> PAGE_SHIFT;
+    for (riscv_word_t page = first; page <= last; page++) {
+        riscv_word_t dir = page >> (PAGE_DIR_SHIFT - PAGE_SHIFT);
+        if (!table->dir[dir]) {
+            table->dir[dir] = calloc(PAGE_TABLE_SIZE, sizeof(page_entry_t));
+            if (!table->dir[dir]) {
+                fprintf(stderr, "alloc page table failed\n");
+                exit(-1);
+            }
+        }
+
+        page_entry_t *entry = &table->dir[dir][page & (PAGE_TABLE_SIZE - 1)];
+        if (entry->device != device) {
+            entry->device_num++;
+        }
+        entry->read = entry->write = (uint8_t *)0;
+        if (entry->device_num > 1) {
+            entry->device = (device_t *)0; // shared, found by walking the device list
+            continue;
+        }
+
+        riscv_word_t start = page << PAGE_SHIFT;
+        entry->device = device;
+        if (device->mem && start >= device->base && start + PAGE_SIZE - 1 <= device->end - 1) {
+            uint8_t *host = device->mem + (start - device->base);
+            entry->read = (device->attr & MEM_ATTR_READABLE) ? host : (uint8_t *)0;
+            entry->write = (writable && (device->attr & MEM_ATTR_WRITABLE)) ? host : (uint8_t *)0;
+        }
+    }
+}
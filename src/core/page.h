@@ -0,0 +1,47 @@
+#ifndef PAGE_H
+#define PAGE_H
+
+#include "core/types.h"
+#include "device/device.h"
+#include <string.h>
+
+// two level table over the 32 bit guest space
+#define PAGE_SHIFT      12
+#define PAGE_SIZE       (1 << PAGE_SHIFT)
+#define PAGE_MASK       (PAGE_SIZE - 1)
+#define PAGE_DIR_SHIFT  22
+#define PAGE_DIR_SIZE   (1 << (32 - PAGE_DIR_SHIFT))
+#define PAGE_TABLE_SIZE (1 << (PAGE_DIR_SHIFT - PAGE_SHIFT))
+
+typedef struct _page_entry_t {
+    uint8_t *read;      // host address of the page if loads may use it directly
+    uint8_t *write;     // same for stores, NULL for flash so writes flush the decode cache
+    device_t *device;   // only device in the page, NULL if none or shared
+    int device_num;     // devices overlapping the page
+}page_entry_t;
+
+typedef struct _page_table_t {
+    page_entry_t *dir[PAGE_DIR_SIZE];
+}page_table_t;
+
+void page_table_map(page_table_t *table, device_t *device, int writable);
+
+static inline page_entry_t *page_lookup(page_table_t *table, riscv_word_t addr) {
+    page_entry_t *pages = table->dir[addr >> PAGE_DIR_SHIFT];
+    return pages ? &pages[(addr >> PAGE_SHIFT) & (PAGE_TABLE_SIZE - 1)] : (page_entry_t *)0;
+}
+
+// constant sizes let the compiler turn the common widths into plain moves
+static inline void page_copy(uint8_t *dst, const uint8_t *src, int width) {
+    if (width == 4) {
+        memcpy(dst, src, 4);
+    } else if (width == 2) {
+        memcpy(dst, src, 2);
+    } else if (width == 1) {
+        memcpy(dst, src, 1);
+    } else {
+        memcpy(dst, src, width);
+    }
+}
+
+#endif
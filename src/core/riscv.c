@@ -4,8 +4,18 @@
 #include <stdio.h>
 #include <string.h>
 #include "core/instr.h"
+#include "core/block.h"
+#include "core/jit.h"
+#include "core/tier.h"
+#include "core/guard.h"
 #include "device/device.h"
 #include <plat/plat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 void riscv_csr_init (riscv_t *riscv) {
     // the regs here actually unused
@@ -41,6 +51,7 @@ void riscv_write_csr (riscv_t * riscv, riscv_word_t csr, riscv_word_t val) {
     switch (csr) {
         case CSR_MSTATUS:
              riscv->csr_regs.mstatus = val;
+             riscv->irq_check = 1; // mie may have been set
              break;
         case CSR_MTVEC:
             riscv->csr_regs.mtvec = val;
@@ -70,6 +81,13 @@ riscv_t *riscv_create(void) {
         return riscv;
     }
 
+    riscv->tier = tier_create();
+    if (!riscv->tier) {
+        free(riscv);
+        return NULL;
+    }
+
+    vtime_init(riscv, VTIME_VIRTUAL, 0, 0);
     return riscv;
 }
 
@@ -77,87 +95,319 @@ void riscv_add_device(riscv_t *riscv, device_t *device) {
     device->next = riscv->device_list;
     riscv->device_list = device;
     device->riscv = riscv;
+    page_table_map(&riscv->page_table, device, 1);
+    if (device->attach) {
+        device->attach(device);
+    }
+}
+
+// pc never leaves flash, breakpoints elsewhere can not hit
+static void riscv_set_bp_map(riscv_t *riscv, riscv_word_t addr, int set) {
+    if (!riscv->bp_map) {
+        return;
+    }
+
+    device_t *flash_dev = &riscv->flash->device;
+    if (addr < flash_dev->base || addr >= flash_dev->end || (addr & 3)) {
+        return;
+    }
+
+    riscv_word_t word = (addr - flash_dev->base) >> 2;
+    if (set) {
+        riscv->bp_map[word >> 3] |= 1 << (word & 7);
+    } else {
+        riscv->bp_map[word >> 3] &= ~(1 << (word & 7));
+    }
 }
 
 void riscv_set_flash(riscv_t *riscv, mem_t *flash) {
     riscv->flash = flash;
+    page_table_map(&riscv->page_table, &flash->device, 0); // writes go through riscv_mem_write to flush
+
+    // one decode slot per flash word, filled in lazily on first fetch
+    free(riscv->decode_cache);
+    device_t *flash_dev = &flash->device;
+    riscv->decode_cache = calloc((flash_dev->end - flash_dev->base) >> 2, sizeof(decoded_instr_t));
+    if (!riscv->decode_cache) {
+        fprintf(stderr, "alloc decode cache failed\n");
+        exit(-1);
+    }
+
+    block_cache_free(riscv->block_cache);
+    riscv->block_cache = block_cache_create(flash_dev->base, flash_dev->end - flash_dev->base);
+    if (!riscv->block_cache) {
+        exit(-1);
+    }
+
+    free(riscv->bp_map);
+    riscv->bp_map = calloc(((flash_dev->end - flash_dev->base) >> 2) / 8 + 1, 1);
+    if (!riscv->bp_map) {
+        fprintf(stderr, "alloc breakpoint map failed\n");
+        exit(-1);
+    }
+    for (breakpoint_t *bp = riscv->bp_list; bp; bp = bp->next) {
+        riscv_set_bp_map(riscv, bp->addr, 1);
+    }
 }
 
 void riscv_set_pfic(riscv_t *riscv, pfic_t *pfic) {
     riscv->pfic = pfic;
 }
 
-void riscv_load_bin(riscv_t *riscv, const char *path) {
+static device_t *riscv_page_device(riscv_t *riscv, riscv_word_t addr);
+
+// the whole file is mapped read only once, fd stays open for mapping pages into flash
+static uint8_t *riscv_open_image(const char *path, size_t *size, int *fd) {
+#ifndef _WIN32
+    *fd = open(path, O_RDONLY);
+    if (*fd < 0) {
+        return (uint8_t *)0;
+    }
+
+    struct stat st;
+    if (fstat(*fd, &st) < 0 || st.st_size == 0) {
+        close(*fd);
+        return (uint8_t *)0;
+    }
+
+    *size = st.st_size;
+    void *image = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, *fd, 0);
+    if (image == MAP_FAILED) {
+        close(*fd);
+        return (uint8_t *)0;
+    }
+    return image;
+#else
+    *fd = -1;
     FILE *file = fopen(path, "rb");
     if (!file) {
-        fprintf(stderr, "open bin file failed, path=%s\n", path);
-        exit(-1);
+        return (uint8_t *)0;
+    }
+
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t *image = *size ? malloc(*size) : (uint8_t *)0;
+    if (image && fread(image, 1, *size, file) < *size) {
+        free(image);
+        image = (uint8_t *)0;
+    }
+    fclose(file);
+    return image;
+#endif
+}
+
+static void riscv_close_image(uint8_t *image, size_t size, int fd) {
+#ifndef _WIN32
+    munmap(image, size);
+    close(fd);
+#else
+    free(image);
+#endif
+}
+
+// page aligned middle of a read only flash range is mapped from the file, the rest is copied
+static void riscv_load_flash(riscv_t *riscv, riscv_word_t addr, const uint8_t *image, int fd,
+                             uint64_t offset, riscv_word_t size) {
+    device_t *flash_dev = &riscv->flash->device;
+    riscv_word_t page = mem_page_size();
+    riscv_word_t head = (page - (addr - flash_dev->base) % page) % page;
+    if (fd >= 0 && (addr - flash_dev->base) % page == offset % page && size > head) {
+        riscv_word_t body = (size - head) & ~(page - 1);
+        if (body && mem_map_file(riscv->flash, addr + head, fd, offset + head, body) == 0) {
+            if (head) {
+                riscv_mem_write(riscv, addr, (uint8_t *)image + offset, head);
+            }
+            if (size - head - body) {
+                riscv_mem_write(riscv, addr + head + body, (uint8_t *)image + offset + head + body, size - head - body);
+            }
+            riscv_flush_decode(riscv, addr + head, body);
+            return;
+        }
     }
 
-    if (feof(file)) {
-        fprintf(stderr, "opened bin file is empty, path=%s\n", path);
-        fclose(file);
+    riscv_mem_write(riscv, addr, (uint8_t *)image + offset, size);
+}
+
+void riscv_load_bin(riscv_t *riscv, const char *path) {
+    size_t size;
+    int fd;
+    uint8_t *image = riscv_open_image(path, &size, &fd);
+    if (!image) {
+        fprintf(stderr, "open bin file failed or empty, path=%s\n", path);
         exit(-1);
     }
 
-    size_t total = 0;
-    size_t read_size;
-    while (read_size = fread(riscv->flash->mem + total, 1, 1024, file)) {
-        total += read_size;
+    device_t *flash_dev = &riscv->flash->device;
+    if (size > flash_dev->end - flash_dev->base) {
+        fprintf(stderr, "bin file larger than flash, path=%s\n", path);
+        exit(-1);
     }
-    
-    fclose(file);
+
+    riscv_load_flash(riscv, flash_dev->base, image, fd, 0, (riscv_word_t)size);
+    riscv_close_image(image, size, fd);
 }
 
 void riscv_load_elf(riscv_t *riscv, const char *path) {
-    FILE *file = fopen(path, "rb");
-    if (!file) {
+    size_t size;
+    int fd;
+    uint8_t *image = riscv_open_image(path, &size, &fd);
+    if (!image) {
         fprintf(stderr, "open file %s failed\n", path);
         exit(-1);
     }
 
-    Elf32_Ehdr elf_hdr;
-    size_t hdr_read = fread(&elf_hdr, 1, sizeof(Elf32_Ehdr), file);
-    if (hdr_read < sizeof(Elf32_Ehdr)) {
+    if (size < sizeof(Elf32_Ehdr)) {
         fprintf(stderr, "read elf file %s header failed\n", path);
         exit(-1);
     }
 
-    for (int i = 0; i < elf_hdr.e_phnum; i++) {
-        fseek(file, elf_hdr.e_phoff + sizeof(Elf32_Phdr) * i, SEEK_SET);
-        Elf32_Phdr elf_phdr;
-        size_t phdr_read = fread(&elf_phdr, 1, sizeof(Elf32_Phdr), file);
-        if (phdr_read < sizeof(Elf32_Phdr)) {
+    Elf32_Ehdr *elf_hdr = (Elf32_Ehdr *)image;
+    for (int i = 0; i < elf_hdr->e_phnum; i++) {
+        uint64_t phdr_off = elf_hdr->e_phoff + (uint64_t)sizeof(Elf32_Phdr) * i;
+        if (phdr_off + sizeof(Elf32_Phdr) > size) {
             fprintf(stderr, "read elf file %s phdr failed\n", path);
             exit(-1);
         }
 
+        Elf32_Phdr elf_phdr;
+        memcpy(&elf_phdr, image + phdr_off, sizeof(Elf32_Phdr));
         if (elf_phdr.p_type != PT_LOAD) {
             continue;
         }
 
-        int sec_size = elf_phdr.p_filesz;
-        char *buf = calloc(1, sec_size);
-        fseek(file, elf_phdr.p_offset, SEEK_SET);
-        size_t sec_read = fread(buf, 1, sec_size, file);
-        if (sec_read < sec_size) {
+        if ((uint64_t)elf_phdr.p_offset + elf_phdr.p_filesz > size) {
             fprintf(stderr, "read elf file %s sections failed\n", path);
             exit(-1);
         }
-        riscv_mem_write(riscv, elf_phdr.p_paddr, buf, sec_size);
-        free(buf);
+
+        // read only segments in flash share the file pages, the rest is copied
+        riscv_word_t addr = elf_phdr.p_paddr;
+        device_t *flash_dev = riscv->flash ? &riscv->flash->device : (device_t *)0;
+        if (flash_dev && !(elf_phdr.p_flags & PF_W) && addr >= flash_dev->base &&
+            addr < flash_dev->end && elf_phdr.p_filesz <= flash_dev->end - addr) {
+            riscv_load_flash(riscv, addr, image, fd, elf_phdr.p_offset, elf_phdr.p_filesz);
+        } else {
+            riscv_mem_write(riscv, addr, image + elf_phdr.p_offset, elf_phdr.p_filesz);
+        }
+
+        // .bss, left to the os to zero fill on first touch where the pages allow it
+        // it lives at the run address, the load address of a .data image is usually in flash
+        if (elf_phdr.p_memsz > elf_phdr.p_filesz) {
+            riscv_word_t bss = elf_phdr.p_vaddr + elf_phdr.p_filesz;
+            device_t *device = riscv_page_device(riscv, bss);
+            if (device && device->mem) {
+                mem_zero((mem_t *)device, bss, elf_phdr.p_memsz - elf_phdr.p_filesz);
+                if (device == flash_dev) {
+                    riscv_flush_decode(riscv, bss, elf_phdr.p_memsz - elf_phdr.p_filesz);
+                }
+            }
+        }
     }
+
+    riscv_close_image(image, size, fd);
 }
 
 void riscv_reset(riscv_t *riscv) {
     riscv->pc = 0;
     riscv->instr.raw = 0;
-    riscv->dev_read = riscv->dev_write = (device_t *)0;
     memset(riscv->regs, 0, sizeof(riscv->regs));
     riscv_csr_init(riscv);
+    riscv->irq_check = 1;
+
+    // flash may have been rewritten behind our back
+    if (riscv->flash) {
+        device_t *flash_dev = &riscv->flash->device;
+        riscv_flush_decode(riscv, flash_dev->base, flash_dev->end - flash_dev->base);
+    }
+}
+
+// device slow paths, below with the device lookup
+static riscv_word_t riscv_mem_load_device(riscv_t *riscv, riscv_word_t addr, int width);
+static void riscv_mem_store_device(riscv_t *riscv, riscv_word_t addr, riscv_word_t val, int width);
+
+// loads and stores of the guest, width is constant at every call so the branches fold
+static inline riscv_word_t riscv_mem_load(riscv_t *riscv, riscv_word_t addr, int width) {
+    page_entry_t *page = page_lookup(&riscv->page_table, addr);
+    if (page && page->read && (addr & PAGE_MASK) + width <= PAGE_SIZE) {
+        uint8_t *host = page->read + (addr & PAGE_MASK);
+        if (width == 4) {
+            uint32_t val;
+            memcpy(&val, host, 4);
+            return val;
+        } else if (width == 2) {
+            uint16_t val;
+            memcpy(&val, host, 2);
+            return val;
+        }
+        return *host;
+    }
+
+    return riscv_mem_load_device(riscv, addr, width);
+}
+
+static inline void riscv_mem_store(riscv_t *riscv, riscv_word_t addr, riscv_word_t val, int width) {
+    page_entry_t *page = page_lookup(&riscv->page_table, addr);
+    if (page && page->write && (addr & PAGE_MASK) + width <= PAGE_SIZE) {
+        uint8_t *host = page->write + (addr & PAGE_MASK);
+        if (width == 4) {
+            uint32_t word = val;
+            memcpy(host, &word, 4);
+        } else if (width == 2) {
+            uint16_t half = (uint16_t)val;
+            memcpy(host, &half, 2);
+        } else {
+            *host = (uint8_t)val;
+        }
+        return;
+    }
+
+    riscv_mem_store_device(riscv, addr, val, width);
+}
+
+// guest loads and stores from the handlers, in guard mode a plain access into the window
+// anything that is not ram or readable flash faults back into the run loop
+static inline riscv_word_t riscv_guest_load(riscv_t *riscv, riscv_word_t addr, int width) {
+    uint8_t *base = riscv->guard_base;
+    if (base) {
+        if (width == 4) {
+            uint32_t val;
+            memcpy(&val, base + addr, 4);
+            return val;
+        } else if (width == 2) {
+            uint16_t val;
+            memcpy(&val, base + addr, 2);
+            return val;
+        }
+        return base[addr];
+    }
+
+    return riscv_mem_load(riscv, addr, width);
+}
+
+static inline void riscv_guest_store(riscv_t *riscv, riscv_word_t addr, riscv_word_t val, int width) {
+    uint8_t *base = riscv->guard_base;
+    if (base) {
+        if (width == 4) {
+            uint32_t word = val;
+            memcpy(base + addr, &word, 4);
+        } else if (width == 2) {
+            uint16_t half = (uint16_t)val;
+            memcpy(base + addr, &half, 2);
+        } else {
+            base[addr] = (uint8_t)val;
+        }
+        return;
+    }
+
+    riscv_mem_store(riscv, addr, val, width);
+}
+
+static void execute_EBREAK(riscv_t *riscv, const decoded_instr_t *instr) {
+    return;
 }
 
-static void execute_EBREAK(riscv_t *riscv, instr_t *instr) {
+static void execute_ILLEGAL(riscv_t *riscv, const decoded_instr_t *instr) {
     return;
 }
 
@@ -191,287 +441,319 @@ static inline int32_t b_get_imm(instr_t *instr) {
     return instr->b.imm_12 ? (imm | (0x1FFFFFFF << 13)) : imm;
 }
 
-static void execute_ADDI(riscv_t *riscv, instr_t *instr) {
-    int32_t imm = i_get_imm(instr);
-    riscv_word_t rd = instr->i.rd;
-    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->i.rs1); // if rs1 invalid?
+static void execute_ADDI(riscv_t *riscv, const decoded_instr_t *instr) {
+    int32_t imm = instr->imm;
+    riscv_word_t rd = instr->rd;
+    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->rs1); // if rs1 invalid?
     
     riscv_write_reg(riscv, rd, rs1_val + imm); // if rd invalid?
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_ORI(riscv_t *riscv, instr_t *instr) {
-    int32_t imm = i_get_imm(instr);
-    riscv_word_t rd = instr->i.rd;
-    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->i.rs1); // if rs1 invalid?
+static void execute_ORI(riscv_t *riscv, const decoded_instr_t *instr) {
+    int32_t imm = instr->imm;
+    riscv_word_t rd = instr->rd;
+    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->rs1); // if rs1 invalid?
     
     riscv_write_reg(riscv, rd, rs1_val | imm); // if rd invalid?
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_ANDI(riscv_t *riscv, instr_t *instr) {
-    int32_t imm = i_get_imm(instr);
-    riscv_word_t rd = instr->i.rd;
-    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->i.rs1); // if rs1 invalid?
+static void execute_ANDI(riscv_t *riscv, const decoded_instr_t *instr) {
+    int32_t imm = instr->imm;
+    riscv_word_t rd = instr->rd;
+    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->rs1); // if rs1 invalid?
     
     riscv_write_reg(riscv, rd, rs1_val & imm); // if rd invalid?
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_XORI(riscv_t *riscv, instr_t *instr) {
-    int32_t imm = i_get_imm(instr);
-    riscv_word_t rd = instr->i.rd;
-    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->i.rs1); // if rs1 invalid?
+static void execute_XORI(riscv_t *riscv, const decoded_instr_t *instr) {
+    int32_t imm = instr->imm;
+    riscv_word_t rd = instr->rd;
+    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->rs1); // if rs1 invalid?
     
     riscv_write_reg(riscv, rd, rs1_val ^ imm); // if rd invalid?
+    riscv->pc += sizeof(riscv_word_t);
 }
 
 // remember only shift right has to consider the polarity 
-static void execute_SLLI(riscv_t *riscv, instr_t *instr) {
-    riscv_word_t shamt = instr->i.imm_11_0 & 0x1F;
-    riscv_word_t rd = instr->i.rd;
-    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->i.rs1); // if rs1 invalid?
+static void execute_SLLI(riscv_t *riscv, const decoded_instr_t *instr) {
+    riscv_word_t shamt = instr->imm & 0x1F;
+    riscv_word_t rd = instr->rd;
+    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->rs1); // if rs1 invalid?
     
     riscv_write_reg(riscv, rd, rs1_val << shamt); // if rd invalid?
+    riscv->pc += sizeof(riscv_word_t);
 }
 
 // in c, >> do sra on signed integers 
 // and do srl on unsigned integers
-static void execute_SRLI(riscv_t *riscv, instr_t *instr) {
-    riscv_word_t shamt = instr->i.imm_11_0 & 0x1F;
-    riscv_word_t rd = instr->i.rd;
-    riscv_word_t rs1_val = riscv_read_reg(riscv, instr->i.rs1); // if rs1 invalid?
+static void execute_SRLI(riscv_t *riscv, const decoded_instr_t *instr) {
+    riscv_word_t shamt = instr->imm & 0x1F;
+    riscv_word_t rd = instr->rd;
+    riscv_word_t rs1_val = riscv_read_reg(riscv, instr->rs1); // if rs1 invalid?
     
     riscv_write_reg(riscv, rd, rs1_val >> shamt); // if rd invalid?
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_SRAI(riscv_t *riscv, instr_t *instr) {
-    riscv_word_t shamt = instr->i.imm_11_0 & 0x1F;
-    riscv_word_t rd = instr->i.rd;
-    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->i.rs1); // if rs1 invalid?
+static void execute_SRAI(riscv_t *riscv, const decoded_instr_t *instr) {
+    riscv_word_t shamt = instr->imm & 0x1F;
+    riscv_word_t rd = instr->rd;
+    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->rs1); // if rs1 invalid?
     
     riscv_write_reg(riscv, rd, rs1_val >> shamt); // if rd invalid?
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_SLTI(riscv_t *riscv, instr_t *instr) {
-    int32_t imm = i_get_imm(instr);
-    riscv_word_t rd = instr->i.rd;
-    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->i.rs1); // if rs1 invalid?
+static void execute_SLTI(riscv_t *riscv, const decoded_instr_t *instr) {
+    int32_t imm = instr->imm;
+    riscv_word_t rd = instr->rd;
+    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->rs1); // if rs1 invalid?
     
     riscv_write_reg(riscv, rd, rs1_val < imm); // if rd invalid?
+    riscv->pc += sizeof(riscv_word_t);
 }
 
 // R[rd] = (R[rs1] <(u) SignExt(imm12))? 1 : 0
-static void execute_SLTIU(riscv_t *riscv, instr_t *instr) {
-    riscv_word_t imm = i_get_imm(instr);
-    riscv_word_t rd = instr->i.rd;
-    riscv_word_t rs1_val = riscv_read_reg(riscv, instr->i.rs1); // if rs1 invalid?
+static void execute_SLTIU(riscv_t *riscv, const decoded_instr_t *instr) {
+    riscv_word_t imm = instr->imm;
+    riscv_word_t rd = instr->rd;
+    riscv_word_t rs1_val = riscv_read_reg(riscv, instr->rs1); // if rs1 invalid?
     
     riscv_write_reg(riscv, rd, rs1_val < imm); // if rd invalid?
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_ADD(riscv_t *riscv, instr_t *instr) {
-    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->r.rs1); // if rs1 invalid?
-    int32_t rs2_val = (int32_t)riscv_read_reg(riscv, instr->r.rs2); // if rs2 invalid?
-    riscv_write_reg(riscv, instr->r.rd, rs1_val + rs2_val); // if rd invalid?
+static void execute_ADD(riscv_t *riscv, const decoded_instr_t *instr) {
+    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->rs1); // if rs1 invalid?
+    int32_t rs2_val = (int32_t)riscv_read_reg(riscv, instr->rs2); // if rs2 invalid?
+    riscv_write_reg(riscv, instr->rd, rs1_val + rs2_val); // if rd invalid?
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_SUB(riscv_t *riscv, instr_t *instr) {
-    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->r.rs1); // if rs1 invalid?
-    int32_t rs2_val = (int32_t)riscv_read_reg(riscv, instr->r.rs2); // if rs2 invalid?
-    riscv_write_reg(riscv, instr->r.rd, rs1_val - rs2_val); // if rd invalid?
+static void execute_SUB(riscv_t *riscv, const decoded_instr_t *instr) {
+    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->rs1); // if rs1 invalid?
+    int32_t rs2_val = (int32_t)riscv_read_reg(riscv, instr->rs2); // if rs2 invalid?
+    riscv_write_reg(riscv, instr->rd, rs1_val - rs2_val); // if rd invalid?
+    riscv->pc += sizeof(riscv_word_t);
 }
 
 // keep the least significant 32 bits
-static void execute_MUL(riscv_t *riscv, instr_t *instr) {
-    int64_t rs1_val = (int64_t)riscv_read_reg(riscv, instr->r.rs1); // if rs1 invalid?
-    int64_t rs2_val = (int64_t)riscv_read_reg(riscv, instr->r.rs2); // if rs2 invalid?
-    riscv_write_reg(riscv, instr->r.rd, (riscv_word_t)(rs1_val * rs2_val)); // if rd invalid?
+static void execute_MUL(riscv_t *riscv, const decoded_instr_t *instr) {
+    int64_t rs1_val = (int64_t)riscv_read_reg(riscv, instr->rs1); // if rs1 invalid?
+    int64_t rs2_val = (int64_t)riscv_read_reg(riscv, instr->rs2); // if rs2 invalid?
+    riscv_write_reg(riscv, instr->rd, (riscv_word_t)(rs1_val * rs2_val)); // if rd invalid?
+    riscv->pc += sizeof(riscv_word_t);
 }
 
 // keep the most significant 32 bits
-static void execute_MULH(riscv_t *riscv, instr_t *instr) {
-    int64_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->r.rs1); // if rs1 invalid?
-    int64_t rs2_val = (int32_t)riscv_read_reg(riscv, instr->r.rs2); // if rs2 invalid?
-    riscv_write_reg(riscv, instr->r.rd, (riscv_word_t)((rs1_val * rs2_val) >> 32)); // if rd invalid?
+static void execute_MULH(riscv_t *riscv, const decoded_instr_t *instr) {
+    int64_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->rs1); // if rs1 invalid?
+    int64_t rs2_val = (int32_t)riscv_read_reg(riscv, instr->rs2); // if rs2 invalid?
+    riscv_write_reg(riscv, instr->rd, (riscv_word_t)((rs1_val * rs2_val) >> 32)); // if rd invalid?
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_MULHSU(riscv_t *riscv, instr_t *instr) {
-    int64_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->r.rs1); // if rs1 invalid?
-    uint64_t rs2_val = riscv_read_reg(riscv, instr->r.rs2); // if rs2 invalid?
-    riscv_write_reg(riscv, instr->r.rd, (riscv_word_t)((rs1_val * rs2_val) >> 32)); // if rd invalid?
+static void execute_MULHSU(riscv_t *riscv, const decoded_instr_t *instr) {
+    int64_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->rs1); // if rs1 invalid?
+    uint64_t rs2_val = riscv_read_reg(riscv, instr->rs2); // if rs2 invalid?
+    riscv_write_reg(riscv, instr->rd, (riscv_word_t)((rs1_val * rs2_val) >> 32)); // if rd invalid?
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_MULHU(riscv_t *riscv, instr_t *instr) {
-    uint64_t rs1_val = riscv_read_reg(riscv, instr->r.rs1); // if rs1 invalid?
-    uint64_t rs2_val = riscv_read_reg(riscv, instr->r.rs2); // if rs2 invalid?
-    riscv_write_reg(riscv, instr->r.rd, (riscv_word_t)((rs1_val * rs2_val) >> 32)); // if rd invalid?
+static void execute_MULHU(riscv_t *riscv, const decoded_instr_t *instr) {
+    uint64_t rs1_val = riscv_read_reg(riscv, instr->rs1); // if rs1 invalid?
+    uint64_t rs2_val = riscv_read_reg(riscv, instr->rs2); // if rs2 invalid?
+    riscv_write_reg(riscv, instr->rd, (riscv_word_t)((rs1_val * rs2_val) >> 32)); // if rd invalid?
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_DIV(riscv_t *riscv, instr_t *instr) {
-    int32_t rs1_val = riscv_read_reg(riscv, instr->r.rs1); // if rs1 invalid?
-    int32_t rs2_val = riscv_read_reg(riscv, instr->r.rs2); // if rs2 invalid?
-    riscv_write_reg(riscv, instr->r.rd, rs1_val / rs2_val); // if rd invalid?
+static void execute_DIV(riscv_t *riscv, const decoded_instr_t *instr) {
+    int32_t rs1_val = riscv_read_reg(riscv, instr->rs1); // if rs1 invalid?
+    int32_t rs2_val = riscv_read_reg(riscv, instr->rs2); // if rs2 invalid?
+    riscv_write_reg(riscv, instr->rd, rs1_val / rs2_val); // if rd invalid?
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_DIVU(riscv_t *riscv, instr_t *instr) {
-    riscv_word_t rs1_val = riscv_read_reg(riscv, instr->r.rs1); // if rs1 invalid?
-    riscv_word_t rs2_val = riscv_read_reg(riscv, instr->r.rs2); // if rs2 invalid?
-    riscv_write_reg(riscv, instr->r.rd, rs1_val / rs2_val); // if rd invalid?
+static void execute_DIVU(riscv_t *riscv, const decoded_instr_t *instr) {
+    riscv_word_t rs1_val = riscv_read_reg(riscv, instr->rs1); // if rs1 invalid?
+    riscv_word_t rs2_val = riscv_read_reg(riscv, instr->rs2); // if rs2 invalid?
+    riscv_write_reg(riscv, instr->rd, rs1_val / rs2_val); // if rd invalid?
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_REM(riscv_t *riscv, instr_t *instr) {
-    int32_t rs1_val = riscv_read_reg(riscv, instr->r.rs1); // if rs1 invalid?
-    int32_t rs2_val = riscv_read_reg(riscv, instr->r.rs2); // if rs2 invalid?
-    riscv_write_reg(riscv, instr->r.rd, rs1_val % rs2_val); // if rd invalid?
+static void execute_REM(riscv_t *riscv, const decoded_instr_t *instr) {
+    int32_t rs1_val = riscv_read_reg(riscv, instr->rs1); // if rs1 invalid?
+    int32_t rs2_val = riscv_read_reg(riscv, instr->rs2); // if rs2 invalid?
+    riscv_write_reg(riscv, instr->rd, rs1_val % rs2_val); // if rd invalid?
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_REMU(riscv_t *riscv, instr_t *instr) {
-    riscv_word_t rs1_val = riscv_read_reg(riscv, instr->r.rs1); // if rs1 invalid?
-    riscv_word_t rs2_val = riscv_read_reg(riscv, instr->r.rs2); // if rs2 invalid?
-    riscv_write_reg(riscv, instr->r.rd, rs1_val % rs2_val); // if rd invalid?
+static void execute_REMU(riscv_t *riscv, const decoded_instr_t *instr) {
+    riscv_word_t rs1_val = riscv_read_reg(riscv, instr->rs1); // if rs1 invalid?
+    riscv_word_t rs2_val = riscv_read_reg(riscv, instr->rs2); // if rs2 invalid?
+    riscv_write_reg(riscv, instr->rd, rs1_val % rs2_val); // if rd invalid?
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_OR(riscv_t *riscv, instr_t *instr) {
-    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->r.rs1); // if rs1 invalid?
-    int32_t rs2_val = (int32_t)riscv_read_reg(riscv, instr->r.rs2); // if rs2 invalid?
-    riscv_write_reg(riscv, instr->r.rd, rs1_val | rs2_val); // if rd invalid?
+static void execute_OR(riscv_t *riscv, const decoded_instr_t *instr) {
+    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->rs1); // if rs1 invalid?
+    int32_t rs2_val = (int32_t)riscv_read_reg(riscv, instr->rs2); // if rs2 invalid?
+    riscv_write_reg(riscv, instr->rd, rs1_val | rs2_val); // if rd invalid?
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_AND(riscv_t *riscv, instr_t *instr) {
-    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->r.rs1); // if rs1 invalid?
-    int32_t rs2_val = (int32_t)riscv_read_reg(riscv, instr->r.rs2); // if rs2 invalid?
-    riscv_write_reg(riscv, instr->r.rd, rs1_val & rs2_val); // if rd invalid?
+static void execute_AND(riscv_t *riscv, const decoded_instr_t *instr) {
+    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->rs1); // if rs1 invalid?
+    int32_t rs2_val = (int32_t)riscv_read_reg(riscv, instr->rs2); // if rs2 invalid?
+    riscv_write_reg(riscv, instr->rd, rs1_val & rs2_val); // if rd invalid?
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_XOR(riscv_t *riscv, instr_t *instr) {
-    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->r.rs1); // if rs1 invalid?
-    int32_t rs2_val = (int32_t)riscv_read_reg(riscv, instr->r.rs2); // if rs2 invalid?
-    riscv_write_reg(riscv, instr->r.rd, rs1_val ^ rs2_val); // if rd invalid?
+static void execute_XOR(riscv_t *riscv, const decoded_instr_t *instr) {
+    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->rs1); // if rs1 invalid?
+    int32_t rs2_val = (int32_t)riscv_read_reg(riscv, instr->rs2); // if rs2 invalid?
+    riscv_write_reg(riscv, instr->rd, rs1_val ^ rs2_val); // if rd invalid?
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_SLL(riscv_t *riscv, instr_t *instr) {
-    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->r.rs1); // if rs1 invalid?
-    riscv_word_t rs2_val = riscv_read_reg(riscv, instr->r.rs2); // if rs2 invalid?
-    riscv_write_reg(riscv, instr->r.rd, rs1_val << rs2_val); // if rd invalid?
+static void execute_SLL(riscv_t *riscv, const decoded_instr_t *instr) {
+    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->rs1); // if rs1 invalid?
+    riscv_word_t rs2_val = riscv_read_reg(riscv, instr->rs2); // if rs2 invalid?
+    riscv_write_reg(riscv, instr->rd, rs1_val << rs2_val); // if rd invalid?
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_SLT(riscv_t *riscv, instr_t *instr) {
-    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->r.rs1); // if rs1 invalid?
-    int32_t rs2_val = (int32_t)riscv_read_reg(riscv, instr->r.rs2); // if rs2 invalid?
-    riscv_write_reg(riscv, instr->r.rd, rs1_val < rs2_val); // if rd invalid?
+static void execute_SLT(riscv_t *riscv, const decoded_instr_t *instr) {
+    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->rs1); // if rs1 invalid?
+    int32_t rs2_val = (int32_t)riscv_read_reg(riscv, instr->rs2); // if rs2 invalid?
+    riscv_write_reg(riscv, instr->rd, rs1_val < rs2_val); // if rd invalid?
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_SLTU(riscv_t *riscv, instr_t *instr) {
-    riscv_word_t rs1_val = riscv_read_reg(riscv, instr->r.rs1); // if rs1 invalid?
-    riscv_word_t rs2_val = riscv_read_reg(riscv, instr->r.rs2); // if rs2 invalid?
-    riscv_write_reg(riscv, instr->r.rd, rs1_val < rs2_val); // if rd invalid?
+static void execute_SLTU(riscv_t *riscv, const decoded_instr_t *instr) {
+    riscv_word_t rs1_val = riscv_read_reg(riscv, instr->rs1); // if rs1 invalid?
+    riscv_word_t rs2_val = riscv_read_reg(riscv, instr->rs2); // if rs2 invalid?
+    riscv_write_reg(riscv, instr->rd, rs1_val < rs2_val); // if rd invalid?
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_SRL(riscv_t *riscv, instr_t *instr) {
-    riscv_word_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->r.rs1); // if rs1 invalid?
-    riscv_word_t rs2_val = (int32_t)riscv_read_reg(riscv, instr->r.rs2); // if rs2 invalid?
-    riscv_write_reg(riscv, instr->r.rd, rs1_val >> rs2_val); // if rd invalid?
+static void execute_SRL(riscv_t *riscv, const decoded_instr_t *instr) {
+    riscv_word_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->rs1); // if rs1 invalid?
+    riscv_word_t rs2_val = (int32_t)riscv_read_reg(riscv, instr->rs2); // if rs2 invalid?
+    riscv_write_reg(riscv, instr->rd, rs1_val >> rs2_val); // if rd invalid?
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_SRA(riscv_t *riscv, instr_t *instr) {
-    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->r.rs1); // if rs1 invalid?
-    riscv_word_t rs2_val = (int32_t)riscv_read_reg(riscv, instr->r.rs2); // if rs2 invalid?
-    riscv_write_reg(riscv, instr->r.rd, rs1_val >> rs2_val); // if rd invalid?
+static void execute_SRA(riscv_t *riscv, const decoded_instr_t *instr) {
+    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->rs1); // if rs1 invalid?
+    riscv_word_t rs2_val = (int32_t)riscv_read_reg(riscv, instr->rs2); // if rs2 invalid?
+    riscv_write_reg(riscv, instr->rd, rs1_val >> rs2_val); // if rd invalid?
+    riscv->pc += sizeof(riscv_word_t);
 }
 
 // Load upper immediate; U; lui rd, imm20; R[rd] = SignExt(imm20 << 12)
-static void execute_LUI(riscv_t *riscv, instr_t *instr) {
-    riscv_word_t imm = u_get_imm(instr);
-    riscv_write_reg(riscv, instr->u.rd, imm); // if rd invalid?
+static void execute_LUI(riscv_t *riscv, const decoded_instr_t *instr) {
+    riscv_word_t imm = instr->imm;
+    riscv_write_reg(riscv, instr->rd, imm); // if rd invalid?
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_AUIPC(riscv_t *riscv, instr_t *instr) {
-    riscv_word_t imm = u_get_imm(instr);
-    riscv_write_reg(riscv, instr->u.rd, imm + riscv->pc); // if rd invalid?
+static void execute_AUIPC(riscv_t *riscv, const decoded_instr_t *instr) {
+    riscv_word_t imm = instr->imm;
+    riscv_write_reg(riscv, instr->rd, imm + riscv->pc); // if rd invalid?
+    riscv->pc += sizeof(riscv_word_t);
 }
 
 // notice that when doing add, signed or unsigned doesn't matter
 // only matters when comparing
-static void execute_SB(riscv_t *riscv, instr_t *instr) {
-    riscv_word_t rs1_val = riscv_read_reg(riscv, instr->s.rs1);
-    riscv_word_t addr = rs1_val + s_get_imm(instr);
-    riscv_word_t rs2_val = riscv_read_reg(riscv, instr->s.rs2);
-    riscv_mem_write(riscv, addr, (uint8_t*)&rs2_val, 1);
+static void execute_SB(riscv_t *riscv, const decoded_instr_t *instr) {
+    riscv_word_t rs1_val = riscv_read_reg(riscv, instr->rs1);
+    riscv_word_t addr = rs1_val + instr->imm;
+    riscv_word_t rs2_val = riscv_read_reg(riscv, instr->rs2);
+    riscv_guest_store(riscv, addr, rs2_val, 1);
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_SH(riscv_t *riscv, instr_t *instr) {
-    riscv_word_t rs1_val = riscv_read_reg(riscv, instr->r.rs1);
-    riscv_word_t addr = rs1_val + s_get_imm(instr);
-    riscv_word_t rs2_val = riscv_read_reg(riscv, instr->r.rs2);
-    riscv_mem_write(riscv, addr, (uint8_t*)&rs2_val, 2);
+static void execute_SH(riscv_t *riscv, const decoded_instr_t *instr) {
+    riscv_word_t rs1_val = riscv_read_reg(riscv, instr->rs1);
+    riscv_word_t addr = rs1_val + instr->imm;
+    riscv_word_t rs2_val = riscv_read_reg(riscv, instr->rs2);
+    riscv_guest_store(riscv, addr, rs2_val, 2);
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_SW(riscv_t *riscv, instr_t *instr) {
-    riscv_word_t rs1_val = riscv_read_reg(riscv, instr->r.rs1);
-    riscv_word_t addr = rs1_val + s_get_imm(instr);
-    riscv_word_t rs2_val = riscv_read_reg(riscv, instr->r.rs2);
-    riscv_mem_write(riscv, addr, (uint8_t*)&rs2_val, 4);
+static void execute_SW(riscv_t *riscv, const decoded_instr_t *instr) {
+    riscv_word_t rs1_val = riscv_read_reg(riscv, instr->rs1);
+    riscv_word_t addr = rs1_val + instr->imm;
+    riscv_word_t rs2_val = riscv_read_reg(riscv, instr->rs2);
+    riscv_guest_store(riscv, addr, rs2_val, 4);
+    riscv->pc += sizeof(riscv_word_t);
 }
 
 // load byte, load half word must do sign extension after loading
 // the imm in load/store can be either positive or negative
-static void execute_LB(riscv_t *riscv, instr_t *instr) {
-    riscv_word_t rs1_val = riscv_read_reg(riscv, instr->i.rs1);
-    riscv_word_t addr = rs1_val + i_get_imm(instr);
-    riscv_word_t byte = 0; // important to reset to zero
-    riscv_mem_read(riscv, addr, (uint8_t*)&byte, 1);
+static void execute_LB(riscv_t *riscv, const decoded_instr_t *instr) {
+    riscv_word_t rs1_val = riscv_read_reg(riscv, instr->rs1);
+    riscv_word_t addr = rs1_val + instr->imm;
+    riscv_word_t byte = riscv_guest_load(riscv, addr, 1);
     byte = byte & (1 << 7) ? (byte | (0xFFFFFF << 8)) : byte;
-    riscv_write_reg(riscv, instr->i.rd, byte);
+    riscv_write_reg(riscv, instr->rd, byte);
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_LBU(riscv_t *riscv, instr_t *instr) {
-    riscv_word_t rs1_val = riscv_read_reg(riscv, instr->i.rs1);
-    riscv_word_t addr = rs1_val + i_get_imm(instr);
-    riscv_word_t byte = 0;
-    riscv_mem_read(riscv, addr, (uint8_t*)&byte, 1);
-    riscv_write_reg(riscv, instr->i.rd, byte);
+static void execute_LBU(riscv_t *riscv, const decoded_instr_t *instr) {
+    riscv_word_t rs1_val = riscv_read_reg(riscv, instr->rs1);
+    riscv_word_t addr = rs1_val + instr->imm;
+    riscv_word_t byte = riscv_guest_load(riscv, addr, 1);
+    riscv_write_reg(riscv, instr->rd, byte);
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_LH(riscv_t *riscv, instr_t *instr) {
-    riscv_word_t rs1_val = riscv_read_reg(riscv, instr->i.rs1);
-    riscv_word_t addr = rs1_val + i_get_imm(instr);
-    riscv_word_t hw;
-    riscv_mem_read(riscv, addr, (uint8_t*)&hw, 2);
+static void execute_LH(riscv_t *riscv, const decoded_instr_t *instr) {
+    riscv_word_t rs1_val = riscv_read_reg(riscv, instr->rs1);
+    riscv_word_t addr = rs1_val + instr->imm;
+    riscv_word_t hw = riscv_guest_load(riscv, addr, 2);
     hw = hw & (1 << 15) ? (hw | (0xFFFFFF << 16)) : hw;
-    riscv_write_reg(riscv, instr->i.rd, hw);
+    riscv_write_reg(riscv, instr->rd, hw);
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_LHU(riscv_t *riscv, instr_t *instr) {
-    riscv_word_t rs1_val = riscv_read_reg(riscv, instr->i.rs1);
-    riscv_word_t addr = rs1_val + i_get_imm(instr);
-    riscv_word_t hw = 0;
-    riscv_mem_read(riscv, addr, (uint8_t*)&hw, 2);
-    riscv_write_reg(riscv, instr->i.rd, hw);
+static void execute_LHU(riscv_t *riscv, const decoded_instr_t *instr) {
+    riscv_word_t rs1_val = riscv_read_reg(riscv, instr->rs1);
+    riscv_word_t addr = rs1_val + instr->imm;
+    riscv_word_t hw = riscv_guest_load(riscv, addr, 2);
+    riscv_write_reg(riscv, instr->rd, hw);
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_LW(riscv_t *riscv, instr_t *instr) {
-    riscv_word_t rs1_val = riscv_read_reg(riscv, instr->i.rs1);
-    riscv_word_t addr = rs1_val + i_get_imm(instr);
-    riscv_word_t word;
-    riscv_mem_read(riscv, addr, (uint8_t*)&word, 4);
-    riscv_write_reg(riscv, instr->i.rd, word);
+static void execute_LW(riscv_t *riscv, const decoded_instr_t *instr) {
+    riscv_word_t rs1_val = riscv_read_reg(riscv, instr->rs1);
+    riscv_word_t addr = rs1_val + instr->imm;
+    riscv_word_t word = riscv_guest_load(riscv, addr, 4);
+    riscv_write_reg(riscv, instr->rd, word);
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_JAL(riscv_t *riscv, instr_t *instr) {
-    int32_t imm = j_get_imm(instr);
-    riscv_write_reg(riscv, instr->j.rd, riscv->pc + 4);
+static void execute_JAL(riscv_t *riscv, const decoded_instr_t *instr) {
+    int32_t imm = instr->imm;
+    riscv_write_reg(riscv, instr->rd, riscv->pc + 4);
     riscv->pc += imm;
 }
 
-static void execute_JALR(riscv_t *riscv, instr_t *instr) {
-    int32_t imm = i_get_imm(instr);
-    int32_t rs1_val = riscv_read_reg(riscv, instr->i.rs1);
-    riscv_write_reg(riscv, instr->i.rd, riscv->pc + 4);
+static void execute_JALR(riscv_t *riscv, const decoded_instr_t *instr) {
+    int32_t imm = instr->imm;
+    int32_t rs1_val = riscv_read_reg(riscv, instr->rs1);
+    riscv_write_reg(riscv, instr->rd, riscv->pc + 4);
     riscv->pc = (rs1_val + imm);
 }
 
-static void execute_BEQ(riscv_t *riscv, instr_t *instr) {
-    int32_t imm = b_get_imm(instr);
-    riscv_word_t rs1_val = riscv_read_reg(riscv, instr->b.rs1);
-    riscv_word_t rs2_val = riscv_read_reg(riscv, instr->b.rs2);
+static void execute_BEQ(riscv_t *riscv, const decoded_instr_t *instr) {
+    int32_t imm = instr->imm;
+    riscv_word_t rs1_val = riscv_read_reg(riscv, instr->rs1);
+    riscv_word_t rs2_val = riscv_read_reg(riscv, instr->rs2);
     if (rs1_val == rs2_val) {
         riscv->pc += imm;
         return;
@@ -479,10 +761,10 @@ static void execute_BEQ(riscv_t *riscv, instr_t *instr) {
     riscv->pc += 4;
 }
 
-static void execute_BGE(riscv_t *riscv, instr_t *instr) {
-    int32_t imm = b_get_imm(instr);
-    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->b.rs1);
-    int32_t rs2_val = (int32_t)riscv_read_reg(riscv, instr->b.rs2);
+static void execute_BGE(riscv_t *riscv, const decoded_instr_t *instr) {
+    int32_t imm = instr->imm;
+    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->rs1);
+    int32_t rs2_val = (int32_t)riscv_read_reg(riscv, instr->rs2);
     if (rs1_val >= rs2_val) {
         riscv->pc += imm;
         return;
@@ -490,10 +772,10 @@ static void execute_BGE(riscv_t *riscv, instr_t *instr) {
     riscv->pc += 4; 
 }
 
-static void execute_BGEU(riscv_t *riscv, instr_t *instr) {
-    int32_t imm = b_get_imm(instr);
-    riscv_word_t rs1_val = riscv_read_reg(riscv, instr->b.rs1);
-    riscv_word_t rs2_val = riscv_read_reg(riscv, instr->b.rs2);
+static void execute_BGEU(riscv_t *riscv, const decoded_instr_t *instr) {
+    int32_t imm = instr->imm;
+    riscv_word_t rs1_val = riscv_read_reg(riscv, instr->rs1);
+    riscv_word_t rs2_val = riscv_read_reg(riscv, instr->rs2);
     if (rs1_val >= rs2_val) {
         riscv->pc += imm;
         return;
@@ -501,10 +783,10 @@ static void execute_BGEU(riscv_t *riscv, instr_t *instr) {
     riscv->pc += 4; 
 }
 
-static void execute_BLT(riscv_t *riscv, instr_t *instr) {
-    int32_t imm = b_get_imm(instr);
-    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->b.rs1);
-    int32_t rs2_val = (int32_t)riscv_read_reg(riscv, instr->b.rs2);
+static void execute_BLT(riscv_t *riscv, const decoded_instr_t *instr) {
+    int32_t imm = instr->imm;
+    int32_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->rs1);
+    int32_t rs2_val = (int32_t)riscv_read_reg(riscv, instr->rs2);
     if (rs1_val < rs2_val) {
         riscv->pc += imm;
         return;
@@ -512,10 +794,10 @@ static void execute_BLT(riscv_t *riscv, instr_t *instr) {
     riscv->pc += 4;
 }
 
-static void execute_BLTU(riscv_t *riscv, instr_t *instr) {
-    int32_t imm = b_get_imm(instr);
-    riscv_word_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->b.rs1);
-    riscv_word_t rs2_val = (int32_t)riscv_read_reg(riscv, instr->b.rs2);
+static void execute_BLTU(riscv_t *riscv, const decoded_instr_t *instr) {
+    int32_t imm = instr->imm;
+    riscv_word_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->rs1);
+    riscv_word_t rs2_val = (int32_t)riscv_read_reg(riscv, instr->rs2);
     if (rs1_val < rs2_val) {
         riscv->pc += imm;
         return;
@@ -523,10 +805,10 @@ static void execute_BLTU(riscv_t *riscv, instr_t *instr) {
     riscv->pc += 4;  
 }
 
-static void execute_BNE(riscv_t *riscv, instr_t *instr) {
-    int32_t imm = b_get_imm(instr);
-    riscv_word_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->b.rs1);
-    riscv_word_t rs2_val = (int32_t)riscv_read_reg(riscv, instr->b.rs2);
+static void execute_BNE(riscv_t *riscv, const decoded_instr_t *instr) {
+    int32_t imm = instr->imm;
+    riscv_word_t rs1_val = (int32_t)riscv_read_reg(riscv, instr->rs1);
+    riscv_word_t rs2_val = (int32_t)riscv_read_reg(riscv, instr->rs2);
     if (rs1_val != rs2_val) {
         riscv->pc += imm;
         return;
@@ -534,149 +816,143 @@ static void execute_BNE(riscv_t *riscv, instr_t *instr) {
     riscv->pc += 4;         
 }
 
-static void execute_CSRRW(riscv_t *riscv, instr_t *instr) {
-    riscv_word_t csr_addr = i_get_imm(instr);
+static void execute_CSRRW(riscv_t *riscv, const decoded_instr_t *instr) {
+    riscv_word_t csr_addr = instr->imm;
     riscv_word_t old_csr = riscv_read_csr(riscv, csr_addr);
-    riscv_word_t new_csr = riscv_read_reg(riscv, instr->i.rs1);
-    riscv_write_reg(riscv, instr->i.rd, old_csr);
-    riscv_write_csr(riscv, csr_addr, new_csr); 
+    riscv_word_t new_csr = riscv_read_reg(riscv, instr->rs1);
+    riscv_write_reg(riscv, instr->rd, old_csr);
+    riscv_write_csr(riscv, csr_addr, new_csr);
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_CSRRS(riscv_t *riscv, instr_t *instr) {
-    riscv_word_t csr_addr = i_get_imm(instr);
+static void execute_CSRRS(riscv_t *riscv, const decoded_instr_t *instr) {
+    riscv_word_t csr_addr = instr->imm;
     riscv_word_t old_csr = riscv_read_csr(riscv, csr_addr);
-    riscv_word_t new_csr = old_csr | riscv_read_reg(riscv, instr->i.rs1);
-    riscv_write_reg(riscv, instr->i.rd, old_csr);
-    riscv_write_csr(riscv, csr_addr, new_csr); 
+    riscv_word_t new_csr = old_csr | riscv_read_reg(riscv, instr->rs1);
+    riscv_write_reg(riscv, instr->rd, old_csr);
+    riscv_write_csr(riscv, csr_addr, new_csr);
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_CSRRC(riscv_t *riscv, instr_t *instr) {
-    riscv_word_t csr_addr = i_get_imm(instr);
+static void execute_CSRRC(riscv_t *riscv, const decoded_instr_t *instr) {
+    riscv_word_t csr_addr = instr->imm;
     riscv_word_t old_csr = riscv_read_csr(riscv, csr_addr);
-    riscv_word_t new_csr = old_csr & (~riscv_read_reg(riscv, instr->i.rs1));
-    riscv_write_reg(riscv, instr->i.rd, old_csr);
-    riscv_write_csr(riscv, csr_addr, new_csr); 
+    riscv_word_t new_csr = old_csr & (~riscv_read_reg(riscv, instr->rs1));
+    riscv_write_reg(riscv, instr->rd, old_csr);
+    riscv_write_csr(riscv, csr_addr, new_csr);
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_CSRRWI(riscv_t *riscv, instr_t *instr) {
-    riscv_word_t csr_addr = i_get_imm(instr);
+static void execute_CSRRWI(riscv_t *riscv, const decoded_instr_t *instr) {
+    riscv_word_t csr_addr = instr->imm;
     riscv_word_t old_csr = riscv_read_csr(riscv, csr_addr);
-    riscv_word_t uimm = instr->i.rs1;
-    riscv_write_reg(riscv, instr->i.rd, old_csr);
-    riscv_write_csr(riscv, csr_addr, uimm); 
+    riscv_word_t uimm = instr->rs1;
+    riscv_write_reg(riscv, instr->rd, old_csr);
+    riscv_write_csr(riscv, csr_addr, uimm);
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_CSRRSI(riscv_t *riscv, instr_t *instr) {
-    riscv_word_t csr_addr = i_get_imm(instr);
+static void execute_CSRRSI(riscv_t *riscv, const decoded_instr_t *instr) {
+    riscv_word_t csr_addr = instr->imm;
     riscv_word_t old_csr = riscv_read_csr(riscv, csr_addr);
-    riscv_word_t uimm = instr->i.rs1;
+    riscv_word_t uimm = instr->rs1;
     riscv_word_t new_csr = old_csr | uimm;
-    riscv_write_reg(riscv, instr->i.rd, old_csr);
-    riscv_write_csr(riscv, csr_addr, new_csr); 
+    riscv_write_reg(riscv, instr->rd, old_csr);
+    riscv_write_csr(riscv, csr_addr, new_csr);
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_CSRRCI(riscv_t *riscv, instr_t *instr) {
-    riscv_word_t csr_addr = i_get_imm(instr);
+static void execute_CSRRCI(riscv_t *riscv, const decoded_instr_t *instr) {
+    riscv_word_t csr_addr = instr->imm;
     riscv_word_t old_csr = riscv_read_csr(riscv, csr_addr);
-    riscv_word_t uimm = instr->i.rs1;
+    riscv_word_t uimm = instr->rs1;
     riscv_word_t new_csr = old_csr & ~uimm;
-    riscv_write_reg(riscv, instr->i.rd, old_csr);
-    riscv_write_csr(riscv, csr_addr, new_csr); 
+    riscv_write_reg(riscv, instr->rd, old_csr);
+    riscv_write_csr(riscv, csr_addr, new_csr);
+    riscv->pc += sizeof(riscv_word_t);
 }
 
-static void execute_MRET(riscv_t *riscv, instr_t *instr) {
+static void execute_MRET(riscv_t *riscv, const decoded_instr_t *instr) {
     riscv_exit_irq(riscv);
 }
 
-static void exec_i_load_instrs(riscv_t *riscv, instr_t *instr) {
+// parks the hart, the run loop waits for an irq after this block
+static void execute_WFI(riscv_t *riscv, const decoded_instr_t *instr) {
+    riscv->pc += sizeof(riscv_word_t);
+    riscv->wfi = 1;
+}
+
+static void decode_i_load_instrs(instr_t *instr, decoded_instr_t *d) {
     riscv_word_t funct3 = instr->i.funct3;
+    d->imm = i_get_imm(instr);
     switch (funct3) {
     case FUNCT3_LB:
-        execute_LB(riscv, instr);
-        riscv->pc += sizeof(riscv_word_t);
+        d->exec = execute_LB;
         break;
     case FUNCT3_LH:
-        execute_LH(riscv, instr);
-        riscv->pc += sizeof(riscv_word_t);
+        d->exec = execute_LH;
         break;
     case FUNCT3_LW:
-        execute_LW(riscv, instr);
-        riscv->pc += sizeof(riscv_word_t);
+        d->exec = execute_LW;
         break;
     case FUNCT3_LBU:
-        execute_LBU(riscv, instr);
-        riscv->pc += sizeof(riscv_word_t);
+        d->exec = execute_LBU;
         break;
     case FUNCT3_LHU:
-        execute_LHU(riscv, instr);
-        riscv->pc += sizeof(riscv_word_t);
+        d->exec = execute_LHU;
         break;
     default:
         break;
     }
 }
 
-static void exec_i_arith_shift_instrs(riscv_t *riscv, instr_t *instr) {
+static void decode_i_arith_shift_instrs(instr_t *instr, decoded_instr_t *d) {
     riscv_word_t funct3 = instr->i.funct3;
     riscv_word_t imm7_0 = instr->i.imm_11_0 >> 5; 
 
+    d->imm = i_get_imm(instr);
     switch (funct3)
     {
     case FUNCT3_ADDI:
-        execute_ADDI(riscv, instr);
-        riscv->pc += sizeof(riscv_word_t);
+        d->exec = execute_ADDI;
         break;
     case FUNCT3_ORI:
-        execute_ORI(riscv, instr);
-        riscv->pc += sizeof(riscv_word_t);
+        d->exec = execute_ORI;
         break;
     case FUNCT3_ANDI:
-        execute_ANDI(riscv, instr);
-        riscv->pc += sizeof(riscv_word_t);
+        d->exec = execute_ANDI;
         break;
     case FUNCT3_XORI:
-        execute_XORI(riscv, instr);
-        riscv->pc += sizeof(riscv_word_t);
+        d->exec = execute_XORI;
         break;
     case FUNCT3_SLTI:
-        execute_SLTI(riscv, instr);
-        riscv->pc += sizeof(riscv_word_t);
+        d->exec = execute_SLTI;
         break;
     case FUNCT3_SLTIU:
-        execute_SLTIU(riscv, instr);
-        riscv->pc += sizeof(riscv_word_t);
+        d->exec = execute_SLTIU;
         break;
     case FUNCT3_SLLI:
-        execute_SLLI(riscv, instr);
-        riscv->pc += sizeof(riscv_word_t);
+        d->exec = execute_SLLI;
         break;
     case FUNCT3_SRLI_SRAI:
         switch (imm7_0) 
         {
         case IMM7_SRLI:
-            execute_SRLI(riscv, instr);
-            riscv->pc += sizeof(riscv_word_t);
+            d->exec = execute_SRLI;
             break;
         case IMM7_SRAI:
-            execute_SRAI(riscv, instr);
-            riscv->pc += sizeof(riscv_word_t);
+            d->exec = execute_SRAI;
             break;
         default:
             break;
         }
         break;
     default:
-        goto exception;
         break;
     }
-
-    return;
-
-    exception:
-    return;
 }
 
-static void exec_r_instrs(riscv_t *riscv, instr_t *instr) {
+static void decode_r_instrs(instr_t *instr, decoded_instr_t *d) {
     riscv_word_t funct3 = instr->r.funct3;
     riscv_word_t funct7 = instr->r.funct7;
 
@@ -686,31 +962,25 @@ static void exec_r_instrs(riscv_t *riscv, instr_t *instr) {
         switch (funct7)
         {
         case FUNCT7_ADD:
-            execute_ADD(riscv, instr);
-            riscv->pc += sizeof(riscv_word_t);
+            d->exec = execute_ADD;
             break;
         case FUNCT7_SUB:
-            execute_SUB(riscv, instr);
-            riscv->pc += sizeof(riscv_word_t);
+            d->exec = execute_SUB;
             break;
         case FUNCT7_MUL:
-            execute_MUL(riscv, instr);
-            riscv->pc += sizeof(riscv_word_t);
+            d->exec = execute_MUL;
             break;
         default:
-            goto exception;
             break;
         }
         break;
     case FUNCT3_OR_REM:
         switch (funct7) {
         case FUNCT7_OR:
-            execute_OR(riscv, instr);
-            riscv->pc += sizeof(riscv_word_t);
+            d->exec = execute_OR;
             break;
         case FUNCT7_REM:
-            execute_REM(riscv, instr);
-            riscv->pc += sizeof(riscv_word_t);
+            d->exec = execute_REM;
             break;
         default:
             break;
@@ -719,12 +989,10 @@ static void exec_r_instrs(riscv_t *riscv, instr_t *instr) {
     case FUNCT3_AND_REMU:
         switch (funct7) {
         case FUNCT7_AND:
-            execute_AND(riscv, instr);
-            riscv->pc += sizeof(riscv_word_t);
+            d->exec = execute_AND;
             break;
         case FUNCT7_REMU:
-            execute_REMU(riscv, instr);
-            riscv->pc += sizeof(riscv_word_t);
+            d->exec = execute_REMU;
             break;
         default:
             break;
@@ -733,12 +1001,10 @@ static void exec_r_instrs(riscv_t *riscv, instr_t *instr) {
     case FUNCT3_SLL_MULH:
         switch (funct7) {
         case FUNCT7_SLL:
-            execute_SLL(riscv, instr);
-            riscv->pc += sizeof(riscv_word_t);
+            d->exec = execute_SLL;
             break;
         case FUNCT7_MULH:
-            execute_MULH(riscv, instr);
-            riscv->pc += sizeof(riscv_word_t);
+            d->exec = execute_MULH;
             break;
         default:
             break;
@@ -747,12 +1013,10 @@ static void exec_r_instrs(riscv_t *riscv, instr_t *instr) {
     case FUNCT3_SLT_MULHSU:
         switch (funct7) {
         case FUNCT7_SLT:
-            execute_SLT(riscv, instr);
-            riscv->pc += sizeof(riscv_word_t);
+            d->exec = execute_SLT;
             break;
         case FUNCT7_MULHSU:
-            execute_MULHSU(riscv, instr);
-            riscv->pc += sizeof(riscv_word_t);
+            d->exec = execute_MULHSU;
             break;
         default:
             break;
@@ -761,12 +1025,10 @@ static void exec_r_instrs(riscv_t *riscv, instr_t *instr) {
     case FUNCT3_SLTU_MULU:
         switch (funct7) {
         case FUNCT7_SLTU:
-            execute_SLTU(riscv, instr);
-            riscv->pc += sizeof(riscv_word_t);
+            d->exec = execute_SLTU;
             break;
         case FUNCT7_MULHU:
-            execute_MULHU(riscv, instr);
-            riscv->pc += sizeof(riscv_word_t);
+            d->exec = execute_MULHU;
             break;
         default:
             break;
@@ -775,12 +1037,10 @@ static void exec_r_instrs(riscv_t *riscv, instr_t *instr) {
     case FUNCT3_XOR_DIV:
         switch (funct7) {
         case FUNCT7_XOR:
-            execute_XOR(riscv, instr);
-            riscv->pc += sizeof(riscv_word_t);
+            d->exec = execute_XOR;
             break;
         case FUNCT7_DIV:
-            execute_DIV(riscv, instr);
-            riscv->pc += sizeof(riscv_word_t);
+            d->exec = execute_DIV;
             break;
         default:
             break;
@@ -790,122 +1050,468 @@ static void exec_r_instrs(riscv_t *riscv, instr_t *instr) {
         switch (funct7) 
         {
         case FUNCT7_SRL:
-            execute_SRL(riscv, instr);
-            riscv->pc += sizeof(riscv_word_t);
+            d->exec = execute_SRL;
             break;
         case FUNCT7_SRA:
-            execute_SRA(riscv, instr);
-            riscv->pc += sizeof(riscv_word_t);
+            d->exec = execute_SRA;
             break;
         case FUNCT7_DIVU:
-            execute_DIVU(riscv, instr);
-            riscv->pc += sizeof(riscv_word_t);
+            d->exec = execute_DIVU;
             break;
         default:
             break;
         }
         break;
     default:
-        goto exception;
         break;
     }
-
-    return;
-
-    exception:
-    return;
 }
 
-static void exec_s_instrs(riscv_t *riscv, instr_t *instr) {
+static void decode_s_instrs(instr_t *instr, decoded_instr_t *d) {
     riscv_word_t funct3 = instr->s.funct3;
+    d->imm = s_get_imm(instr);
     switch (funct3) {
     case FUNCT3_SB:
-        execute_SB(riscv, instr);
-        riscv->pc += sizeof(riscv_word_t);
+        d->exec = execute_SB;
         break;
     case FUNCT3_SH:
-        execute_SH(riscv, instr);
-        riscv->pc += sizeof(riscv_word_t);
+        d->exec = execute_SH;
         break;
     case FUNCT3_SW:
-        execute_SW(riscv, instr);
-        riscv->pc += sizeof(riscv_word_t);
+        d->exec = execute_SW;
         break;
     default:
         break;
     }
 }
 
-static void exec_b_instrs(riscv_t *riscv, instr_t *instr) {
+static void decode_b_instrs(instr_t *instr, decoded_instr_t *d) {
     riscv_word_t funct3 = instr->b.funct3;
+    d->imm = b_get_imm(instr);
+    d->flags |= DECODE_JUMP;
     switch (funct3) {
     case FUNCT3_BEQ:
-        execute_BEQ(riscv, instr);
+        d->exec = execute_BEQ;
         break;
     case FUNCT3_BGE:
-        execute_BGE(riscv, instr);
+        d->exec = execute_BGE;
         break;
     case FUNCT3_BGEU:
-        execute_BGEU(riscv, instr);
+        d->exec = execute_BGEU;
         break;
     case FUNCT3_BLT:
-        execute_BLT(riscv, instr);
+        d->exec = execute_BLT;
         break;
     case FUNCT3_BLTU:
-        execute_BLTU(riscv, instr);
+        d->exec = execute_BLTU;
         break;
     case FUNCT3_BNE:
-        execute_BNE(riscv, instr);
+        d->exec = execute_BNE;
         break;
     default:
         break;
     }
 }
 
-static void exec_special_instrs(riscv_t *riscv, instr_t *instr) {
+static void decode_special_instrs(instr_t *instr, decoded_instr_t *d) {
     riscv_word_t funct3 = instr->r.funct3;
     riscv_word_t funct7 = instr->r.funct7;
+
+    // csr addresses are unsigned, don't sign extend them
+    d->imm = instr->i.imm_11_0;
     switch (funct3) {
     case FUNCT3_EBREAK_MRET:
         switch (funct7) {
             case FUNCT7_EBREAK:
+                if (instr->raw == EBREAK) {
+                    d->exec = execute_EBREAK;
+                    d->flags |= DECODE_STOP;
+                }
                 break;
             case FUNCT7_MRET:
-                execute_MRET(riscv, instr);
+                d->exec = execute_MRET;
+                d->flags |= DECODE_JUMP;
+                break;
+            case FUNCT7_WFI:
+                if (instr->raw == WFI) {
+                    d->exec = execute_WFI;
+                    d->flags |= DECODE_JUMP; // ends the block so the loop sees it parked
+                }
                 break;
             default:
                 break;
         }
         break;
     case FUNCT3_CSRRW:
-        execute_CSRRW(riscv, instr);
-        riscv->pc += sizeof(riscv_word_t);
+        d->exec = execute_CSRRW;
         break;
     case FUNCT3_CSRRS:
-        execute_CSRRS(riscv, instr);
-        riscv->pc += sizeof(riscv_word_t);
+        d->exec = execute_CSRRS;
         break;
     case FUNCT3_CSRRC:
-        execute_CSRRC(riscv, instr);
-        riscv->pc += sizeof(riscv_word_t);
+        d->exec = execute_CSRRC;
         break;
     case FUNCT3_CSRRWI:
-        execute_CSRRWI(riscv, instr);
-        riscv->pc += sizeof(riscv_word_t);
+        d->exec = execute_CSRRWI;
         break;
     case FUNCT3_CSRRSI:
-        execute_CSRRSI(riscv, instr);
-        riscv->pc += sizeof(riscv_word_t);
+        d->exec = execute_CSRRSI;
         break;
     case FUNCT3_CSRRCI:
-        execute_CSRRCI(riscv, instr);
-        riscv->pc += sizeof(riscv_word_t);
+        d->exec = execute_CSRRCI;
         break;
     default:
         break;
     }
 }
 
+// walk the opcode/funct switches once per static instruction
+// the result is kept in the decode cache until the flash word is rewritten
+void riscv_decode(riscv_word_t raw, decoded_instr_t *d) {
+    instr_t instr;
+    instr.raw = raw;
+
+    memset(d, 0, sizeof(decoded_instr_t));
+    d->rd = instr.r.rd;
+    d->rs1 = instr.r.rs1;
+    d->rs2 = instr.r.rs2;
+
+    switch(instr.opcode) {
+        case OP_EBREAK_CSR:
+            decode_special_instrs(&instr, d);
+            break;
+        case OP_LUI:
+            d->imm = u_get_imm(&instr);
+            d->exec = execute_LUI;
+            break;
+        case OP_AUIPC:
+            d->imm = u_get_imm(&instr);
+            d->exec = execute_AUIPC;
+            break;
+        case OP_JAL:
+            d->imm = j_get_imm(&instr);
+            d->exec = execute_JAL;
+            d->flags |= DECODE_JUMP;
+            break;
+        case OP_JALR:
+            d->imm = i_get_imm(&instr);
+            d->exec = execute_JALR;
+            d->flags |= DECODE_JUMP;
+            break;
+        case OP_I_ARITH_SHIFT_INSTR:
+            decode_i_arith_shift_instrs(&instr, d);
+            break;
+        case OP_I_LOAD_INSTR:
+            decode_i_load_instrs(&instr, d);
+            break;
+        case OP_R_INSTR:
+            decode_r_instrs(&instr, d);
+            break;
+        case OP_S_INSTR:
+            decode_s_instrs(&instr, d);
+            break;
+        case OP_B_INSTR:
+            decode_b_instrs(&instr, d);
+            break;
+        default:
+            break;
+    }
+
+    // unknown encodings stop the cpu before executing, same as ebreak
+    if (!d->exec) {
+        d->exec = execute_ILLEGAL;
+        d->flags = DECODE_STOP;
+    }
+}
+
+void riscv_flush_decode(riscv_t *riscv, riscv_word_t addr, riscv_word_t size) {
+    if (!riscv->decode_cache) {
+        return;
+    }
+
+    device_t *flash_dev = &riscv->flash->device;
+    riscv_word_t start = addr < flash_dev->base ? flash_dev->base : addr;
+    riscv_word_t end = (addr + size > flash_dev->end || addr + size < addr) ? flash_dev->end : addr + size;
+    for (riscv_word_t pc = start & ~3; pc < end; pc += sizeof(riscv_word_t)) {
+        riscv->decode_cache[(pc - flash_dev->base) >> 2].exec = NULL;
+    }
+
+    block_invalidate(riscv->block_cache, start, end - start);
+}
+
+decoded_instr_t *riscv_decode_at(riscv_t *riscv, riscv_word_t pc) {
+    device_t *flash_dev = &riscv->flash->device;
+    decoded_instr_t *instr = &riscv->decode_cache[(pc - flash_dev->base) >> 2];
+    if (!instr->exec) {
+        riscv_word_t *mem = (riscv_word_t *)riscv->flash->mem;
+        riscv_decode(mem[(pc - flash_dev->base) >> 2], instr);
+    }
+
+    return instr;
+}
+
+// fused pairs, instr is the first entry and instr + 1 the second one
+// the first rd is still written since later code may read it, fusing requires rd != 0
+static void fuse_LUI_ADDI(riscv_t *riscv, const decoded_instr_t *instr) {
+    riscv_word_t val = instr->imm;
+    riscv->regs[instr->rd] = val;
+    riscv_write_reg(riscv, instr[1].rd, val + instr[1].imm);
+    riscv->pc += 2 * sizeof(riscv_word_t);
+    riscv->fuse_stats.runs[FUSE_LUI_ADDI]++;
+}
+
+static void fuse_AUIPC_JALR(riscv_t *riscv, const decoded_instr_t *instr) {
+    riscv_word_t val = riscv->pc + instr->imm;
+    riscv->regs[instr->rd] = val;
+    riscv_write_reg(riscv, instr[1].rd, riscv->pc + 2 * sizeof(riscv_word_t));
+    riscv->pc = val + instr[1].imm;
+    riscv->fuse_stats.runs[FUSE_AUIPC_JALR]++;
+}
+
+static void fuse_AUIPC_ADDI(riscv_t *riscv, const decoded_instr_t *instr) {
+    riscv_word_t val = riscv->pc + instr->imm;
+    riscv->regs[instr->rd] = val;
+    riscv_write_reg(riscv, instr[1].rd, val + instr[1].imm);
+    riscv->pc += 2 * sizeof(riscv_word_t);
+    riscv->fuse_stats.runs[FUSE_AUIPC_ADDI]++;
+}
+
+static void fuse_AUIPC_LW(riscv_t *riscv, const decoded_instr_t *instr) {
+    riscv_word_t val = riscv->pc + instr->imm;
+    riscv->regs[instr->rd] = val;
+    riscv_word_t word = riscv_guest_load(riscv, val + instr[1].imm, 4);
+    riscv_write_reg(riscv, instr[1].rd, word);
+    riscv->pc += 2 * sizeof(riscv_word_t);
+    riscv->fuse_stats.runs[FUSE_AUIPC_LW]++;
+}
+
+static void fuse_LUI_LW(riscv_t *riscv, const decoded_instr_t *instr) {
+    riscv_word_t val = instr->imm;
+    riscv->regs[instr->rd] = val;
+    riscv_word_t word = riscv_guest_load(riscv, val + instr[1].imm, 4);
+    riscv_write_reg(riscv, instr[1].rd, word);
+    riscv->pc += 2 * sizeof(riscv_word_t);
+    riscv->fuse_stats.runs[FUSE_LUI_LW]++;
+}
+
+static void fuse_LUI_SW(riscv_t *riscv, const decoded_instr_t *instr) {
+    riscv_word_t val = instr->imm;
+    riscv->regs[instr->rd] = val;
+    riscv_word_t rs2_val = riscv_read_reg(riscv, instr[1].rs2); // may be the lui rd
+    riscv_guest_store(riscv, val + instr[1].imm, rs2_val, 4);
+    riscv->pc += 2 * sizeof(riscv_word_t);
+    riscv->fuse_stats.runs[FUSE_LUI_SW]++;
+}
+
+// compare then beqz/bnez on its result, the branch is at pc + 4
+#define FUSE_CMP_BRANCH_FN(name, type, rhs, taken) \
+static void fuse_##name(riscv_t *riscv, const decoded_instr_t *instr) { \
+    riscv_word_t val = (type)riscv_read_reg(riscv, instr->rs1) < (type)(rhs); \
+    riscv->regs[instr->rd] = val; \
+    riscv->pc += (taken) ? sizeof(riscv_word_t) + instr[1].imm : 2 * sizeof(riscv_word_t); \
+    riscv->fuse_stats.runs[FUSE_CMP_BRANCH]++; \
+}
+
+FUSE_CMP_BRANCH_FN(SLT_BEQ, int32_t, riscv_read_reg(riscv, instr->rs2), val == 0)
+FUSE_CMP_BRANCH_FN(SLT_BNE, int32_t, riscv_read_reg(riscv, instr->rs2), val != 0)
+FUSE_CMP_BRANCH_FN(SLTU_BEQ, riscv_word_t, riscv_read_reg(riscv, instr->rs2), val == 0)
+FUSE_CMP_BRANCH_FN(SLTU_BNE, riscv_word_t, riscv_read_reg(riscv, instr->rs2), val != 0)
+FUSE_CMP_BRANCH_FN(SLTI_BEQ, int32_t, instr->imm, val == 0)
+FUSE_CMP_BRANCH_FN(SLTI_BNE, int32_t, instr->imm, val != 0)
+FUSE_CMP_BRANCH_FN(SLTIU_BEQ, riscv_word_t, instr->imm, val == 0)
+FUSE_CMP_BRANCH_FN(SLTIU_BNE, riscv_word_t, instr->imm, val != 0)
+
+typedef struct _fuse_rule_t {
+    exec_fn_t first;
+    exec_fn_t second;
+    exec_fn_t fused;
+    int kind;
+}fuse_rule_t;
+
+static const fuse_rule_t fuse_rules[] = {
+    {execute_LUI,   execute_ADDI, fuse_LUI_ADDI,   FUSE_LUI_ADDI},
+    {execute_AUIPC, execute_JALR, fuse_AUIPC_JALR, FUSE_AUIPC_JALR},
+    {execute_AUIPC, execute_ADDI, fuse_AUIPC_ADDI, FUSE_AUIPC_ADDI},
+    {execute_AUIPC, execute_LW,   fuse_AUIPC_LW,   FUSE_AUIPC_LW},
+    {execute_LUI,   execute_LW,   fuse_LUI_LW,     FUSE_LUI_LW},
+    {execute_LUI,   execute_SW,   fuse_LUI_SW,     FUSE_LUI_SW},
+    {execute_SLT,   execute_BEQ,  fuse_SLT_BEQ,    FUSE_CMP_BRANCH},
+    {execute_SLT,   execute_BNE,  fuse_SLT_BNE,    FUSE_CMP_BRANCH},
+    {execute_SLTU,  execute_BEQ,  fuse_SLTU_BEQ,   FUSE_CMP_BRANCH},
+    {execute_SLTU,  execute_BNE,  fuse_SLTU_BNE,   FUSE_CMP_BRANCH},
+    {execute_SLTI,  execute_BEQ,  fuse_SLTI_BEQ,   FUSE_CMP_BRANCH},
+    {execute_SLTI,  execute_BNE,  fuse_SLTI_BNE,   FUSE_CMP_BRANCH},
+    {execute_SLTIU, execute_BEQ,  fuse_SLTIU_BEQ,  FUSE_CMP_BRANCH},
+    {execute_SLTIU, execute_BNE,  fuse_SLTIU_BNE,  FUSE_CMP_BRANCH},
+};
+
+static const char *fuse_names[FUSE_NUM] = {
+    "lui+addi", "auipc+jalr", "auipc+addi", "auipc+lw", "lui+lw", "lui+sw", "cmp+branch"
+};
+
+// the second entry stays in place, the jit still compiles from it
+void riscv_fuse_block(riscv_t *riscv, block_t *block) {
+    for (int i = 0; i + 1 < block->instr_num; i++) {
+        decoded_instr_t *first = &block->instrs[i];
+        decoded_instr_t *second = first + 1;
+        if (first->rd == 0 || second->rs1 != first->rd) {
+            continue;
+        }
+        // branches only fuse against zero
+        if ((second->exec == execute_BEQ || second->exec == execute_BNE) && second->rs2 != 0) {
+            continue;
+        }
+
+        for (size_t r = 0; r < sizeof(fuse_rules) / sizeof(fuse_rules[0]); r++) {
+            if (first->exec == fuse_rules[r].first && second->exec == fuse_rules[r].second) {
+                first->exec = fuse_rules[r].fused;
+                first->flags |= DECODE_FUSED;
+                riscv->fuse_stats.sites[fuse_rules[r].kind]++;
+                i++;
+                break;
+            }
+        }
+    }
+}
+
+void riscv_fuse_report(riscv_t *riscv, FILE *file) {
+    fprintf(file, "fusion:\n");
+    for (int i = 0; i < FUSE_NUM; i++) {
+        fprintf(file, "  %-12s %8llu sites %14llu runs\n", fuse_names[i],
+                (unsigned long long)riscv->fuse_stats.sites[i], (unsigned long long)riscv->fuse_stats.runs[i]);
+    }
+}
+
+static const exec_fn_t spin_loads[] = {
+    execute_LB, execute_LBU, execute_LH, execute_LHU, execute_LW,
+};
+static const exec_fn_t spin_imm_ops[] = {
+    execute_ADDI, execute_ORI, execute_ANDI, execute_XORI, execute_SLLI, execute_SRLI, execute_SRAI,
+    execute_SLTI, execute_SLTIU,
+};
+static const exec_fn_t spin_reg_ops[] = {
+    execute_ADD, execute_SUB, execute_MUL, execute_MULH, execute_MULHSU, execute_MULHU, execute_DIV,
+    execute_DIVU, execute_REM, execute_REMU, execute_OR, execute_AND, execute_XOR, execute_SLL,
+    execute_SLT, execute_SLTU, execute_SRL, execute_SRA,
+};
+static const exec_fn_t spin_branches[] = {
+    execute_BEQ, execute_BNE, execute_BLT, execute_BGE, execute_BLTU, execute_BGEU,
+};
+
+static int spin_exec_in(exec_fn_t exec, const exec_fn_t *list, int num) {
+    for (int i = 0; i < num; i++) {
+        if (list[i] == exec) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+#define SPIN_IN(exec, list) spin_exec_in(exec, list, sizeof(list) / sizeof(list[0]))
+
+// a short loop back to its own entry made only of loads, alu ops and the branch
+// no register may carry a value from one lap into the next, so every lap computes
+// the same thing from the same memory until a device event changes that memory
+void riscv_spin_block(riscv_t *riscv, block_t *block) {
+    block->spin = 0;
+    block->spin_loads = 0;
+
+    int n = block->instr_num;
+    if (n > BLOCK_SPIN_MAX_INSTRS) {
+        return;
+    }
+
+    decoded_instr_t *last = &block->instrs[n - 1];
+    riscv_word_t last_pc = block->pc + (n - 1) * sizeof(riscv_word_t);
+    if (last->exec == execute_JAL && last->rd != 0) {
+        return;
+    }
+    if ((last->exec != execute_JAL && !SPIN_IN(last->exec, spin_branches)) || last_pc + last->imm != block->pc) {
+        return;
+    }
+
+    uint32_t reads[BLOCK_SPIN_MAX_INSTRS], writes[BLOCK_SPIN_MAX_INSTRS];
+    uint32_t written = 0;
+    for (int i = 0; i < n; i++) {
+        decoded_instr_t *instr = &block->instrs[i];
+        reads[i] = writes[i] = 0;
+        if (SPIN_IN(instr->exec, spin_loads) || SPIN_IN(instr->exec, spin_imm_ops)) {
+            reads[i] = 1u << instr->rs1;
+            writes[i] = 1u << instr->rd;
+        } else if (SPIN_IN(instr->exec, spin_reg_ops)) {
+            reads[i] = (1u << instr->rs1) | (1u << instr->rs2);
+            writes[i] = 1u << instr->rd;
+        } else if (instr->exec == execute_LUI || instr->exec == execute_AUIPC) {
+            writes[i] = 1u << instr->rd;
+        } else if (SPIN_IN(instr->exec, spin_branches)) {
+            reads[i] = (1u << instr->rs1) | (1u << instr->rs2);
+        } else if (instr->exec != execute_JAL) {
+            return; // stores, csrs, jumps and the like
+        }
+        reads[i] &= ~1u;
+        writes[i] &= ~1u;
+        written |= writes[i];
+    }
+
+    uint32_t defined = 0;
+    uint8_t loads = 0;
+    for (int i = 0; i < n; i++) {
+        if (reads[i] & written & ~defined) {
+            return; // read before this lap wrote it, so it comes from the last lap
+        }
+        defined |= writes[i];
+
+        // the address is recomputed from the regs after a lap, its base must still hold it
+        if (SPIN_IN(block->instrs[i].exec, spin_loads)) {
+            uint32_t base = 1u << block->instrs[i].rs1;
+            for (int j = i; j < n; j++) {
+                if (writes[j] & base) {
+                    return;
+                }
+            }
+            loads |= 1 << i;
+        }
+    }
+
+    block->spin = 1;
+    block->spin_loads = loads;
+}
+
+// after a lap of a busy wait that went round again, jump to the next device event
+// the laps in between are counted as retired, they would have run on the real part
+void riscv_spin_skip(riscv_t *riscv, block_t *block) {
+    vtime_t *vtime = &riscv->vtime;
+    if (vtime->mode != VTIME_VIRTUAL || vtime->check == VTIME_NEVER || vtime->check <= riscv->instret) {
+        return;
+    }
+    if (riscv->irq_check && (riscv->csr_regs.mstatus & (1 << 3))) {
+        return; // an irq may be taken right after this block
+    }
+
+    // ram, flash and quiet mmio only change through events, timed mmio changes on its own
+    for (int i = 0; i < block->instr_num; i++) {
+        if (!(block->spin_loads & (1 << i))) {
+            continue;
+        }
+        decoded_instr_t *instr = &block->instrs[i];
+        riscv_word_t addr = riscv->regs[instr->rs1] + instr->imm;
+        page_entry_t *page = page_lookup(&riscv->page_table, addr);
+        if (page && page->read) {
+            continue;
+        }
+        device_t *device = riscv_page_device(riscv, addr);
+        if (!device || (device->timed && device->timed(device, addr & ~3))) {
+            return;
+        }
+    }
+
+    uint64_t n = block->instr_num;
+    uint64_t laps = (vtime->check - riscv->instret + n - 1) / n;
+    riscv->instret += laps * n;
+    block->prof->spin_skips++;
+    block->prof->spin_laps += laps;
+}
+
 int gdb_stop = 0;
 int thread_stop = 0;
 
@@ -929,6 +1535,53 @@ static void handle_gdb_stop_thread(void *arg) {
     setsockopt(server->client, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout));
 }
 
+// is removing the pending after entering the handler a correct way?
+// no, since another interrupt might come and have higher priority
+// priorities are only resolved after irq_check was raised
+static inline void riscv_check_irq(riscv_t *riscv) {
+    if (riscv->irq_check && (riscv->csr_regs.mstatus & (1 << 3))) {
+        riscv->irq_check = 0; // cleared before the scan so a raise during it is kept
+        int irq = pfic_get_irq_pending(riscv->pfic, riscv->active_irq);
+        if (irq >= 0) {
+            riscv_enter_irq(riscv, irq, riscv->pc, irq, 0);
+        }
+    }
+}
+
+// parked by wfi, wakes once an irq is pending whether mie lets it in or not,
+// or which handler is running, the clock moves straight to each device event,
+// or sleeps on the host in wall mode
+static void riscv_wait_for_irq(riscv_t *riscv) {
+    riscv->wfi_num++;
+    while (!gdb_stop) {
+        if (riscv->instret >= riscv->vtime.check) {
+            vtime_poll(riscv); // a host thread kicked, its device may raise an irq
+        }
+
+        if (pfic_get_irq_pending(riscv->pfic, -1) >= 0) {
+            riscv->wfi = 0;
+            return;
+        }
+
+        if (riscv->vtime.deadline == VTIME_NEVER) {
+            thread_msleep(VTIME_SLEEP_MAX_MS); // only the host side, gdb or a kick, can wake it now
+            continue;
+        }
+        vtime_advance(riscv, riscv->vtime.deadline);
+    }
+}
+
+// device events fire between blocks, before their irqs are looked at
+static inline void riscv_block_end(riscv_t *riscv) {
+    if (riscv->instret >= riscv->vtime.check) {
+        vtime_poll(riscv);
+    }
+    if (riscv->wfi) {
+        riscv_wait_for_irq(riscv);
+    }
+    riscv_check_irq(riscv);
+}
+
 void riscv_fetch_and_execute(riscv_t *riscv, int forever) {
     device_t *flash_dev = &riscv->flash->device;
     if (riscv->pc < flash_dev->base || riscv->pc >= flash_dev->end) { // end is not valid address
@@ -936,85 +1589,69 @@ void riscv_fetch_and_execute(riscv_t *riscv, int forever) {
         return;
     }
 
+    // single step
+    if (!forever) {
+        decoded_instr_t *instr = riscv_decode_at(riscv, riscv->pc);
+        if (!(instr->flags & DECODE_STOP)) {
+            instr->exec(riscv, instr);
+            if (++riscv->instret >= riscv->vtime.check) {
+                vtime_poll(riscv);
+            }
+            riscv_check_irq(riscv);
+        }
+        return;
+    }
+
     HANDLE handle;
-    if (riscv->gdb_server && forever) {
+    if (riscv->gdb_server) {
         gdb_stop = 0;
         thread_stop = 0;
         handle = thread_create(handle_gdb_stop_thread, riscv->gdb_server);
     }
-    
+
+    guard_t *guard = riscv->guard;
+#ifdef __linux__
+    if (guard && sigsetjmp(guard->fault_jmp, 0)) {
+        // a guest access hit mmio, a hole or flash, the run it was in goes on the slow way
+        riscv->guard_base = (uint8_t *)0;
+        guard->faults++;
+        tier_resume(riscv);
+        riscv_block_end(riscv);
+    }
+    if (guard) {
+        guard->active = 1;
+        riscv->guard_base = guard->window;
+    }
+#endif
+
+    // pc range, breakpoints, irqs and gdb pause are checked once per block
     do {
-        if (riscv->pc >= flash_dev->end) {
-            goto exception;
+        if (riscv->wfi) { // gdb stopped it while parked, park again before running on
+            riscv_block_end(riscv);
+            continue;
         }
 
-        if (forever) {
-            int detect = riscv_detect_breakpoint(riscv, riscv->pc);
-            if (detect) {
-                break;
-            }
+        if (riscv->pc < flash_dev->base || riscv->pc >= flash_dev->end) {
+            goto exception;
         }
-        
-        riscv_word_t *mem = (riscv_word_t *)riscv->flash->mem;
-        riscv->instr.raw = mem[(riscv->pc - flash_dev->base) >> 2];
 
-        switch(riscv->instr.opcode) {
-            case OP_EBREAK_CSR:
-                exec_special_instrs(riscv, &riscv->instr);
-                if (riscv->instr.raw == EBREAK) {
-                    goto ebreak;
-                }
-                break;
-            case OP_LUI:
-                execute_LUI(riscv, &riscv->instr);
-                riscv->pc += sizeof(riscv_word_t);
-                break;
-            case OP_AUIPC:
-                execute_AUIPC(riscv, &riscv->instr);
-                riscv->pc += sizeof(riscv_word_t);
-                break;
-            case OP_JAL:
-                execute_JAL(riscv, &riscv->instr);
-                // riscv->pc += sizeof(riscv_word_t); // no need to add four for jal
-                break;
-            case OP_JALR:
-                execute_JALR(riscv, &riscv->instr);
-                // riscv->pc += sizeof(riscv_word_t); // no need to add four for jalr
-                break;
-            case OP_I_ARITH_SHIFT_INSTR:
-                exec_i_arith_shift_instrs(riscv, &riscv->instr);
-                break;
-            case OP_I_LOAD_INSTR:
-                exec_i_load_instrs(riscv, &riscv->instr);
-                break;
-            case OP_R_INSTR:
-                exec_r_instrs(riscv, &riscv->instr);
-                break;
-            case OP_S_INSTR:
-                exec_s_instrs(riscv, &riscv->instr);
-                break;
-            case OP_B_INSTR:
-                exec_b_instrs(riscv, &riscv->instr);
-                break;
-            default:
-                goto exception;
-                break;
+        if (riscv->block_cache->retired) {
+            block_free_retired(riscv->block_cache);
         }
 
-        // is removing the pending after entering the handler a correct way?
-        // no, since another interrupt might come and have higher priority
-        if (riscv->csr_regs.mstatus & (1 << 3)) {
-            int irq = pfic_get_irq_pending(riscv->pfic);
-            if (irq >= 0 && irq != riscv->active_irq) {
-                riscv_enter_irq(riscv, irq, riscv->pc, irq, 0);
-            } 
+        if (tier_exec(riscv) < 0) {
+            break; // ebreak, unknown encoding or breakpoint at pc
         }
-
-    } while (forever && !gdb_stop);
+        riscv_block_end(riscv);
+    } while (!gdb_stop);
 
 exception: 
-ebreak:
-    if (riscv->gdb_server && forever) {
+    if (guard) {
+        guard->active = 0;
+        riscv->guard_base = (uint8_t *)0;
+    }
+
+    if (riscv->gdb_server) {
         thread_stop = 1;
         thread_wait(handle);
     }
@@ -1035,35 +1672,128 @@ static device_t *riscv_find_device(riscv_t *riscv, riscv_word_t addr) {
     return ret;
 }
 
+// the page names the device unless several share it
+static device_t *riscv_page_device(riscv_t *riscv, riscv_word_t addr) {
+    page_entry_t *page = page_lookup(&riscv->page_table, addr);
+    device_t *device = page ? page->device : (device_t *)0;
+    if (!device || addr < device->base || addr >= device->end) {
+        device = riscv_find_device(riscv, addr);
+    }
+
+    return device;
+}
+
+// host address of a guest range for devices that move data in bulk, NULL unless
+// one memory device backs all of it, stores into flash still need riscv_flush_decode
+uint8_t *riscv_mem_host(riscv_t *riscv, riscv_word_t addr, riscv_word_t size) {
+    device_t *device = riscv_page_device(riscv, addr);
+    if (!device || !device->mem || (uint64_t)addr + size > device->end) {
+        return (uint8_t *)0;
+    }
+    return device->mem + (addr - device->base);
+}
+
+// typed callbacks first, the generic one for devices without them
+static riscv_word_t riscv_mem_load_device(riscv_t *riscv, riscv_word_t addr, int width) {
+    device_t *device = riscv_page_device(riscv, addr);
+    if (!device) {
+        fprintf(stderr, "read at an invalid mem address, addr=%x\n", addr);
+        return 0;
+    }
+
+    if (width == 4 && device->read32) {
+        return device->read32(device, addr);
+    } else if (width == 2 && device->read16) {
+        return device->read16(device, addr);
+    } else if (width == 1 && device->read8) {
+        return device->read8(device, addr);
+    }
+
+    riscv_word_t val = 0;
+    device->read(device, addr, (uint8_t*)&val, width);
+    return val;
+}
+
+static void riscv_mem_store_device(riscv_t *riscv, riscv_word_t addr, riscv_word_t val, int width) {
+    if (riscv->flash && addr >= riscv->flash->device.base && addr < riscv->flash->device.end) {
+        riscv_flush_decode(riscv, addr, width); // self-modifying code
+    }
+
+    device_t *device = riscv_page_device(riscv, addr);
+    if (!device) {
+        fprintf(stderr, "write at an invalid mem address, addr=%x\n", addr);
+        return;
+    }
+
+    if (width == 4 && device->write32) {
+        device->write32(device, addr, val);
+    } else if (width == 2 && device->write16) {
+        device->write16(device, addr, (uint16_t)val);
+    } else if (width == 1 && device->write8) {
+        device->write8(device, addr, (uint8_t)val);
+    } else {
+        device->write(device, addr, (uint8_t*)&val, width);
+    }
+}
+
+riscv_word_t riscv_mem_read8(riscv_t *riscv, riscv_word_t addr) {
+    return riscv_mem_load(riscv, addr, 1);
+}
+
+riscv_word_t riscv_mem_read16(riscv_t *riscv, riscv_word_t addr) {
+    return riscv_mem_load(riscv, addr, 2);
+}
+
+riscv_word_t riscv_mem_read32(riscv_t *riscv, riscv_word_t addr) {
+    return riscv_mem_load(riscv, addr, 4);
+}
+
+void riscv_mem_write8(riscv_t *riscv, riscv_word_t addr, riscv_word_t val) {
+    riscv_mem_store(riscv, addr, val, 1);
+}
+
+void riscv_mem_write16(riscv_t *riscv, riscv_word_t addr, riscv_word_t val) {
+    riscv_mem_store(riscv, addr, val, 2);
+}
+
+void riscv_mem_write32(riscv_t *riscv, riscv_word_t addr, riscv_word_t val) {
+    riscv_mem_store(riscv, addr, val, 4);
+}
+
+// generic access for odd sizes and bulk transfers (loader, gdb)
 int riscv_mem_read(riscv_t *riscv, riscv_word_t addr, uint8_t *val, int width) {
-    device_t *dev_read = riscv->dev_read;
-    if (dev_read && addr >= dev_read->base && addr < dev_read->end) {
-        return dev_read->read(dev_read, addr, val, width);
-    } 
-    
-    device_t *device = riscv_find_device(riscv, addr);
+    page_entry_t *page = page_lookup(&riscv->page_table, addr);
+    if (page && page->read && (addr & PAGE_MASK) + width <= PAGE_SIZE) {
+        page_copy(val, page->read + (addr & PAGE_MASK), width);
+        return 0;
+    }
+
+    device_t *device = riscv_page_device(riscv, addr);
     if (!device) {
         fprintf(stderr, "read at an invalid mem address, addr=%x\n", addr);
         return -1;
     }
 
-    riscv->dev_read = device;
     return device->read(device, addr, val, width);
 }
 
 int riscv_mem_write(riscv_t *riscv, riscv_word_t addr, uint8_t *val, int width) {
-    device_t *dev_write = riscv->dev_write;
-    if (dev_write && addr >= dev_write->base && addr < dev_write->end) {
-        return dev_write->write(dev_write, addr, val, width);
-    } 
-    
-    device_t *device = riscv_find_device(riscv, addr);
+    page_entry_t *page = page_lookup(&riscv->page_table, addr);
+    if (page && page->write && (addr & PAGE_MASK) + width <= PAGE_SIZE) {
+        page_copy(page->write + (addr & PAGE_MASK), val, width);
+        return 0;
+    }
+
+    if (riscv->flash && addr >= riscv->flash->device.base && addr < riscv->flash->device.end) {
+        riscv_flush_decode(riscv, addr, width); // self-modifying code, loader or gdb
+    }
+
+    device_t *device = riscv_page_device(riscv, addr);
     if (!device) {
         fprintf(stderr, "write at an invalid mem address, addr=%x\n", addr);
         return -1;
     }
 
-    riscv->dev_write = device;
     return device->write(device, addr, val, width);
 }
 
@@ -1082,6 +1812,9 @@ void riscv_add_breakpoint(riscv_t *riscv, riscv_word_t addr) {
     new->addr = addr;
     new->next = riscv->bp_list;
     riscv->bp_list = new;
+
+    riscv_set_bp_map(riscv, addr, 1);
+    block_invalidate(riscv->block_cache, addr, sizeof(riscv_word_t)); // split the block at addr
 }
 
 int riscv_remove_breakpoint(riscv_t *riscv, riscv_word_t addr) {
@@ -1096,6 +1829,7 @@ int riscv_remove_breakpoint(riscv_t *riscv, riscv_word_t addr) {
             } else {
                 riscv->bp_list = curr->next;
             }
+            free(curr);
             break;
         }
 
@@ -1103,19 +1837,33 @@ int riscv_remove_breakpoint(riscv_t *riscv, riscv_word_t addr) {
         curr = curr->next;
     }
 
+    // the same address may have been added more than once
+    if (remove) {
+        int left = 0;
+        for (curr = riscv->bp_list; curr; curr = curr->next) {
+            left |= curr->addr == addr;
+        }
+        if (!left) {
+            riscv_set_bp_map(riscv, addr, 0);
+            block_invalidate(riscv->block_cache, addr, sizeof(riscv_word_t));
+        }
+    }
+
     return remove;
 }
 
 int riscv_detect_breakpoint(riscv_t *riscv, riscv_word_t addr) {
-    breakpoint_t *curr = riscv->bp_list;
-    while (curr) {
-        if (curr->addr == addr) {
-            return 1;
-        }
-        curr = curr->next;
+    if (!riscv->bp_map) {
+        return 0;
     }
 
-    return 0;
+    device_t *flash_dev = &riscv->flash->device;
+    if (addr < flash_dev->base || addr >= flash_dev->end || (addr & 3)) {
+        return 0;
+    }
+
+    riscv_word_t word = (addr - flash_dev->base) >> 2;
+    return (riscv->bp_map[word >> 3] >> (word & 7)) & 1;
 }
 
 // set the csr regs and pc
@@ -1130,17 +1878,19 @@ void riscv_enter_irq(riscv_t *riscv, int irq, riscv_word_t mepc, riscv_word_t mc
     riscv_word_t base = riscv->csr_regs.mtvec & 0xFFFFFFFC;
     riscv_word_t handler_saved_addr = base + irq * 4;
     
-    riscv_mem_read(riscv, handler_saved_addr, (uint8_t*)&riscv->pc, sizeof(riscv_word_t));
+    riscv->pc = riscv_mem_read32(riscv, handler_saved_addr);
     riscv->active_irq = irq;
+    // taken, so no longer pending, a device raising it again while the handler runs
+    // is kept and taken after mret instead of being cleared with this one
+    pfic_clear_irq_pending(riscv->pfic, irq);
 }
 
 // recover regs
 // reset active irq
-// reset pfic regs
 void riscv_exit_irq(riscv_t *riscv) {
     riscv->pc = riscv->csr_regs.mepc;
     riscv->csr_regs.mstatus &= ~(1 << 3);
     riscv->csr_regs.mstatus |= (riscv->csr_regs.mstatus & (1 << 7)) >> 4;
-    pfic_clear_irq_pending(riscv->pfic, riscv->active_irq);
     riscv->active_irq = 0;
+    riscv->irq_check = 1; // mie is back and other irqs may be waiting
 }
@@ -4,11 +4,18 @@
 #include "types.h"
 #include "device/mem.h"
 #include "core/instr.h"
+#include "core/block.h"
+#include "core/jit.h"
+#include "core/tier.h"
+#include "core/page.h"
+#include "core/guard.h"
+#include "core/vtime.h"
 #include "gdb/gdb_server.h"
 #include "device/pfic.h"
 
 #define EI_NIDENT (16)
 #define PT_LOAD 1       /* Loadable program segment */
+#define PF_W    (1 << 1) /* Segment is writable */
 #define ELFMAG0	0x7f    /* Magic number byte 0 */
 
 typedef uint32_t Elf32_Word;
@@ -81,12 +88,26 @@ typedef struct _riscv_t {
     riscv_word_t regs[RISCV_REGS_NUM];
     riscv_word_t pc;
     instr_t instr;
+    decoded_instr_t *decode_cache;
+    block_cache_t *block_cache;
+    jit_t *jit;
+    tier_t *tier;
+    fuse_stats_t fuse_stats;
     device_t *device_list;
-    device_t *dev_read;
-    device_t *dev_write;
+    page_table_t page_table;
+    guard_t *guard;
+    uint8_t *guard_base;    // guard window while the run loop uses it, NULL otherwise
+    block_t *run_block;     // block being run, a guard fault finishes it on the slow path
+    tier_prof_t *run_prof;  // the interpreted run's profile when there is no block
     csr_regs_t csr_regs;
     breakpoint_t *bp_list;
+    uint8_t *bp_map;        // bit per flash word, mirrors bp_list for lookups
     int active_irq;
+    uint64_t instret;       // guest instrs retired, the virtual time base
+    int wfi;                // parked by wfi until an irq is pending
+    uint64_t wfi_num;
+    vtime_t vtime;
+    volatile int irq_check; // an irq may have become deliverable, raised by pfic and mstatus writes
 }riscv_t;
 
 #define riscv_read_reg(riscv, reg) (riscv->regs[reg])
@@ -99,13 +120,27 @@ void riscv_load_bin(riscv_t *riscv, const char *path);
 void riscv_load_elf(riscv_t *riscv, const char *path);
 void riscv_continue(riscv_t *riscv, int forever);
 void riscv_fetch_and_execute(riscv_t *riscv, int forever);
+void riscv_decode(riscv_word_t raw, decoded_instr_t *d);
+void riscv_flush_decode(riscv_t *riscv, riscv_word_t addr, riscv_word_t size);
+decoded_instr_t *riscv_decode_at(riscv_t *riscv, riscv_word_t pc);
+void riscv_fuse_block(riscv_t *riscv, block_t *block);
+void riscv_fuse_report(riscv_t *riscv, FILE *file);
+void riscv_spin_block(riscv_t *riscv, block_t *block);
+void riscv_spin_skip(riscv_t *riscv, block_t *block);
 void riscv_reset(riscv_t *riscv);
 void riscv_csr_init(riscv_t *riscv);
 riscv_word_t riscv_read_csr(riscv_t *riscv, riscv_word_t addr);
 void riscv_write_csr(riscv_t *riscv, riscv_word_t addr, riscv_word_t val);
 int riscv_mem_read(riscv_t *riscv, riscv_word_t addr, uint8_t *val, int width);
 int riscv_mem_write(riscv_t *riscv, riscv_word_t addr, uint8_t *val, int width);
+riscv_word_t riscv_mem_read8(riscv_t *riscv, riscv_word_t addr);
+riscv_word_t riscv_mem_read16(riscv_t *riscv, riscv_word_t addr);
+riscv_word_t riscv_mem_read32(riscv_t *riscv, riscv_word_t addr);
+void riscv_mem_write8(riscv_t *riscv, riscv_word_t addr, riscv_word_t val);
+void riscv_mem_write16(riscv_t *riscv, riscv_word_t addr, riscv_word_t val);
+void riscv_mem_write32(riscv_t *riscv, riscv_word_t addr, riscv_word_t val);
 void riscv_add_device(riscv_t *riscv, device_t *device);
+uint8_t *riscv_mem_host(riscv_t *riscv, riscv_word_t addr, riscv_word_t size);
 void riscv_run(riscv_t *riscv);
 void riscv_add_breakpoint(riscv_t *riscv, riscv_word_t addr);
 int riscv_remove_breakpoint(riscv_t *riscv, riscv_word_t addr);
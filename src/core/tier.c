@@ -0,0 +1,260 @@
+#include "core/riscv.h"
+#include "core/tier.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TIER_TABLE_INIT_SIZE 1024
+
+static const char *tier_names[TIER_NUM] = {"interp", "threaded", "native"};
+
+tier_t *tier_create(void) {
+    tier_t *tier = calloc(1, sizeof(tier_t));
+    if (!tier) {
+        fprintf(stderr, "alloc tier failed\n");
+        return tier;
+    }
+
+    tier->table_size = TIER_TABLE_INIT_SIZE;
+    tier->table = calloc(tier->table_size, sizeof(tier_prof_t *));
+    if (!tier->table) {
+        fprintf(stderr, "alloc tier failed\n");
+        free(tier);
+        return NULL;
+    }
+
+    return tier;
+}
+
+static inline uint32_t tier_hash(riscv_word_t pc, uint32_t size) {
+    return ((pc >> 2) * 2654435761u) & (size - 1);
+}
+
+static void tier_grow(tier_t *tier) {
+    uint32_t size = tier->table_size * 2;
+    tier_prof_t **table = calloc(size, sizeof(tier_prof_t *));
+    if (!table) {
+        return; // keep the longer chains
+    }
+
+    for (uint32_t i = 0; i < tier->table_size; i++) {
+        tier_prof_t *prof = tier->table[i];
+        while (prof) {
+            tier_prof_t *next = prof->next;
+            uint32_t idx = tier_hash(prof->pc, size);
+            prof->next = table[idx];
+            table[idx] = prof;
+            prof = next;
+        }
+    }
+
+    free(tier->table);
+    tier->table = table;
+    tier->table_size = size;
+}
+
+// entries are allocated one by one so blocks can keep pointers to them
+tier_prof_t *tier_prof_get(tier_t *tier, riscv_word_t pc) {
+    uint32_t idx = tier_hash(pc, tier->table_size);
+    for (tier_prof_t *prof = tier->table[idx]; prof; prof = prof->next) {
+        if (prof->pc == pc) {
+            return prof;
+        }
+    }
+
+    tier_prof_t *prof = calloc(1, sizeof(tier_prof_t));
+    if (!prof) {
+        fprintf(stderr, "alloc tier profile failed\n");
+        exit(-1);
+    }
+    prof->pc = pc;
+    prof->next = tier->table[idx];
+    tier->table[idx] = prof;
+
+    if (++tier->prof_num > tier->table_size) {
+        tier_grow(tier);
+    }
+    return prof;
+}
+
+// cold code, decode cache only, up to and including the first jump
+// first is where in the run pc is, runs resumed after a guard fault start past 0
+static int tier_interp(riscv_t *riscv, tier_prof_t *prof, int first) {
+    device_t *flash_dev = &riscv->flash->device;
+
+    for (int i = first; i < BLOCK_MAX_INSTRS; i++) {
+        if (riscv->pc >= flash_dev->end) {
+            break;
+        }
+
+        if (riscv->bp_list && riscv_detect_breakpoint(riscv, riscv->pc)) {
+            return i == 0 ? -1 : 0; // stop there on the next lap
+        }
+
+        decoded_instr_t *instr = riscv_decode_at(riscv, riscv->pc);
+        if (instr->flags & DECODE_STOP) {
+            return i == 0 ? -1 : 0;
+        }
+
+        instr->exec(riscv, instr);
+        prof->instrs[TIER_INTERP]++;
+        riscv->instret++;
+        if (instr->flags & DECODE_JUMP) {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+// a fused entry executes the next one too
+static void tier_run_entries(riscv_t *riscv, block_t *block, decoded_instr_t *instr) {
+    decoded_instr_t *end = block->instrs + block->instr_num;
+    while (instr < end) {
+        instr->exec(riscv, instr);
+        instr += (instr->flags & DECODE_FUSED) ? 2 : 1;
+    }
+}
+
+static void tier_block_retired(riscv_t *riscv, block_t *block, int tier) {
+    tier_prof_t *prof = block->prof;
+    prof->runs[tier]++;
+    prof->instrs[tier] += block->instr_num;
+    riscv->instret += block->instr_num;
+    if (block->spin && riscv->pc == block->pc) {
+        riscv_spin_skip(riscv, block);
+    }
+}
+
+// run the block at pc in its current tier, promote it if it got hot
+// returns -1 when stopped at ebreak, an unknown encoding or a breakpoint
+int tier_exec(riscv_t *riscv) {
+    block_t *block = block_find(riscv->block_cache, riscv->pc);
+    if (!block) {
+        tier_prof_t *prof = tier_prof_get(riscv->tier, riscv->pc);
+        if (prof->runs[TIER_INTERP] < TIER_BLOCK_THRESHOLD) {
+            prof->runs[TIER_INTERP]++;
+            riscv->run_block = NULL;
+            riscv->run_prof = prof;
+            return tier_interp(riscv, prof, 0);
+        }
+
+        block = block_translate(riscv, riscv->pc);
+        if (!block) {
+            return -1; // ebreak or unknown encoding at pc
+        }
+        block->prof = prof;
+        if (prof->tier < TIER_THREADED) {
+            prof->tier = TIER_THREADED;
+        }
+    }
+
+    // blocks end before any breakpoint, so only the entry can hit one
+    if (riscv->bp_list && riscv_detect_breakpoint(riscv, block->pc)) {
+        return -1;
+    }
+
+    tier_prof_t *prof = block->prof;
+    riscv->run_block = block;
+    if (block->native) {
+        block->native(riscv);
+        tier_block_retired(riscv, block, TIER_NATIVE);
+        return 0;
+    }
+
+    uint8_t *guard_base = riscv->guard_base;
+    if (block->guard_off) {
+        riscv->guard_base = (uint8_t *)0;
+    }
+    tier_run_entries(riscv, block, block->instrs);
+    riscv->guard_base = guard_base;
+    tier_block_retired(riscv, block, TIER_THREADED);
+
+    // retried every JIT_HOT_THRESHOLD runs if compiling failed or code was flushed
+    if (riscv->jit && !block->native && prof->runs[TIER_THREADED] % JIT_HOT_THRESHOLD == 0) {
+        block->native = jit_compile(riscv->jit, riscv, block);
+        if (block->native) {
+            prof->tier = TIER_NATIVE;
+        }
+    }
+
+    return 0;
+}
+
+// a guard fault left the run at pc, still at the entry that faulted since handlers move
+// pc after their access, fused ones too, so the rest is finished with the window off
+// and the run retires and is profiled as if it had gone through, virtual time included
+void tier_resume(riscv_t *riscv) {
+    block_t *block = riscv->run_block;
+    if (!block) {
+        tier_interp(riscv, riscv->run_prof, 1);
+        return;
+    }
+
+    block->guard_off = 1;
+    tier_run_entries(riscv, block, block->instrs + (riscv->pc - block->pc) / sizeof(riscv_word_t));
+    tier_block_retired(riscv, block, block->native ? TIER_NATIVE : TIER_THREADED);
+}
+
+static int tier_prof_cmp(const void *a, const void *b) {
+    const tier_prof_t *pa = *(const tier_prof_t **)a;
+    const tier_prof_t *pb = *(const tier_prof_t **)b;
+    uint64_t ta = pa->instrs[TIER_INTERP] + pa->instrs[TIER_THREADED] + pa->instrs[TIER_NATIVE];
+    uint64_t tb = pb->instrs[TIER_INTERP] + pb->instrs[TIER_THREADED] + pb->instrs[TIER_NATIVE];
+    return ta < tb ? 1 : (ta > tb ? -1 : 0);
+}
+
+static int tier_spin_cmp(const void *a, const void *b) {
+    const tier_prof_t *pa = *(const tier_prof_t **)a;
+    const tier_prof_t *pb = *(const tier_prof_t **)b;
+    return pa->spin_laps < pb->spin_laps ? 1 : (pa->spin_laps > pb->spin_laps ? -1 : 0);
+}
+
+// guest instrs retired is used as the measure of where time goes
+void tier_report(tier_t *tier, FILE *file) {
+    tier_prof_t **profs = calloc(tier->prof_num + 1, sizeof(tier_prof_t *));
+    if (!profs) {
+        return;
+    }
+
+    uint64_t total[TIER_NUM] = {0};
+    uint64_t all = 0;
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < tier->table_size; i++) {
+        for (tier_prof_t *prof = tier->table[i]; prof; prof = prof->next) {
+            profs[n++] = prof;
+            for (int t = 0; t < TIER_NUM; t++) {
+                total[t] += prof->instrs[t];
+                all += prof->instrs[t];
+            }
+        }
+    }
+    qsort(profs, n, sizeof(tier_prof_t *), tier_prof_cmp);
+
+    fprintf(file, "tier profile: %llu instrs in %u blocks\n", (unsigned long long)all, n);
+    for (int t = 0; t < TIER_NUM; t++) {
+        fprintf(file, "  %-8s %14llu instrs %6.2f%%\n", tier_names[t],
+                (unsigned long long)total[t], all ? 100.0 * total[t] / all : 0.0);
+    }
+
+    fprintf(file, "  %-10s %14s %7s %-8s %12s %12s %12s\n",
+            "pc", "instrs", "%", "tier", "interp", "threaded", "native");
+    for (uint32_t i = 0; i < n && i < TIER_REPORT_MAX; i++) {
+        tier_prof_t *prof = profs[i];
+        uint64_t instrs = prof->instrs[TIER_INTERP] + prof->instrs[TIER_THREADED] + prof->instrs[TIER_NATIVE];
+        fprintf(file, "  0x%08x %14llu %6.2f%% %-8s %12llu %12llu %12llu\n",
+                prof->pc, (unsigned long long)instrs, all ? 100.0 * instrs / all : 0.0,
+                tier_names[prof->tier], (unsigned long long)prof->runs[TIER_INTERP],
+                (unsigned long long)prof->runs[TIER_THREADED], (unsigned long long)prof->runs[TIER_NATIVE]);
+    }
+
+    qsort(profs, n, sizeof(tier_prof_t *), tier_spin_cmp);
+    fprintf(file, "busy waits skipped:\n");
+    fprintf(file, "  %-10s %12s %16s\n", "pc", "skips", "laps elided");
+    for (uint32_t i = 0; i < n && i < TIER_REPORT_MAX && profs[i]->spin_skips; i++) {
+        fprintf(file, "  0x%08x %12llu %16llu\n", profs[i]->pc,
+                (unsigned long long)profs[i]->spin_skips, (unsigned long long)profs[i]->spin_laps);
+    }
+
+    free(profs);
+}
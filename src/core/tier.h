@@ -0,0 +1,40 @@
+#ifndef TIER_H
+#define TIER_H
+
+#include <stdio.h>
+#include "core/types.h"
+
+#define TIER_INTERP     0 // one decoded instr at a time
+#define TIER_THREADED   1 // translated block
+#define TIER_NATIVE     2 // jit compiled block
+#define TIER_NUM        3
+
+#define TIER_BLOCK_THRESHOLD    16 // interpreted entries of a pc before its block gets translated
+#define TIER_REPORT_MAX         32 // hottest blocks listed by tier_report
+
+struct _riscv_t;
+
+// per block entry pc, kept across invalidations so the report covers the whole run
+typedef struct _tier_prof_t {
+    riscv_word_t pc;
+    int tier;                   // highest tier reached
+    uint64_t runs[TIER_NUM];    // entries per tier, also the hotness counters
+    uint64_t instrs[TIER_NUM];  // guest instrs retired per tier
+    uint64_t spin_skips;        // times a busy wait here was skipped to the next device event
+    uint64_t spin_laps;         // laps of it not executed
+    struct _tier_prof_t *next;  // hash chain
+}tier_prof_t;
+
+typedef struct _tier_t {
+    tier_prof_t **table;
+    uint32_t table_size;
+    uint32_t prof_num;
+}tier_t;
+
+tier_t *tier_create(void);
+tier_prof_t *tier_prof_get(tier_t *tier, riscv_word_t pc);
+int tier_exec(struct _riscv_t *riscv);
+void tier_resume(struct _riscv_t *riscv);
+void tier_report(tier_t *tier, FILE *file);
+
+#endif
@@ -0,0 +1,241 @@
+#include "core/riscv.h"
+#include "core/vtime.h"
+#include "device/systick.h"
+#include <stdlib.h>
+#include "plat/plat.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+static uint64_t vtime_host_ns(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (uint64_t)((double)count.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// split so instret * VTIME_IPC_ONE can not overflow
+static uint64_t vtime_instret_to_cycle(vtime_t *vtime, uint64_t instret) {
+    uint64_t q = instret / vtime->ipc, r = instret % vtime->ipc;
+    return q * VTIME_IPC_ONE + r * VTIME_IPC_ONE / vtime->ipc;
+}
+
+// first instret whose cycle is at or past cycle
+static uint64_t vtime_cycle_to_instret(vtime_t *vtime, uint64_t cycle) {
+    uint64_t q = cycle / VTIME_IPC_ONE, r = cycle % VTIME_IPC_ONE;
+    return q * vtime->ipc + (r * vtime->ipc + VTIME_IPC_ONE - 1) / VTIME_IPC_ONE;
+}
+
+// check is also written by vtime_kick from other threads, a kick landing while
+// it is recomputed here is seen by the load of kicked after the store
+static void vtime_rearm(riscv_t *riscv) {
+    vtime_t *vtime = &riscv->vtime;
+    uint64_t check;
+    vtime->deadline = vtime->event_num ? vtime->events[0].cycle : VTIME_NEVER;
+    if (vtime->deadline == VTIME_NEVER) {
+        check = VTIME_NEVER;
+    } else if (vtime->mode == VTIME_WALL) {
+        check = riscv->instret + VTIME_WALL_POLL;
+    } else if (vtime->deadline <= vtime->idle) {
+        check = 0;
+    } else {
+        check = vtime_cycle_to_instret(vtime, vtime->deadline - vtime->idle);
+    }
+
+    __atomic_store_n(&vtime->check, check, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&vtime->kicked, __ATOMIC_SEQ_CST)) {
+        __atomic_store_n(&vtime->check, 0, __ATOMIC_SEQ_CST);
+    }
+}
+
+static inline int vtime_event_before(vtime_event_t *a, vtime_event_t *b) {
+    return a->cycle < b->cycle || (a->cycle == b->cycle && a->seq < b->seq);
+}
+
+static void vtime_sift_up(vtime_t *vtime, uint32_t i) {
+    vtime_event_t event = vtime->events[i];
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (!vtime_event_before(&event, &vtime->events[parent])) {
+            break;
+        }
+        vtime->events[i] = vtime->events[parent];
+        i = parent;
+    }
+    vtime->events[i] = event;
+}
+
+static void vtime_sift_down(vtime_t *vtime, uint32_t i) {
+    vtime_event_t event = vtime->events[i];
+    while (1) {
+        uint32_t child = 2 * i + 1;
+        if (child >= vtime->event_num) {
+            break;
+        }
+        if (child + 1 < vtime->event_num && vtime_event_before(&vtime->events[child + 1], &vtime->events[child])) {
+            child++;
+        }
+        if (!vtime_event_before(&vtime->events[child], &event)) {
+            break;
+        }
+        vtime->events[i] = vtime->events[child];
+        i = child;
+    }
+    vtime->events[i] = event;
+}
+
+static void vtime_remove(vtime_t *vtime, uint32_t i) {
+    vtime->event_num--;
+    if (i == vtime->event_num) {
+        return;
+    }
+    vtime->events[i] = vtime->events[vtime->event_num];
+    vtime_sift_down(vtime, i);
+    vtime_sift_up(vtime, i);
+}
+
+// a handful of devices at most, a linear search beats keeping an index in every event
+static int vtime_find(vtime_t *vtime, vtime_fn_t fn, void *arg) {
+    for (uint32_t i = 0; i < vtime->event_num; i++) {
+        if (vtime->events[i].fn == fn && vtime->events[i].arg == arg) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+// freq and ipc of 0 keep the defaults, SYSTICK_FREQ and one instr per cycle
+// pending events are dropped, their cycles were worked out under the old clock
+void vtime_init(riscv_t *riscv, int mode, uint64_t freq, uint32_t ipc) {
+    vtime_t *vtime = &riscv->vtime;
+    vtime->mode = mode;
+    vtime->freq = freq ? freq : SYSTICK_FREQ;
+    vtime->ipc = ipc ? ipc : VTIME_IPC_ONE;
+    vtime->wall_start = vtime_host_ns();
+    vtime->idle = 0;
+    vtime->event_num = 0;
+    vtime_rearm(riscv);
+}
+
+// guest core cycles since vtime_init
+uint64_t vtime_now(riscv_t *riscv) {
+    vtime_t *vtime = &riscv->vtime;
+    if (vtime->mode == VTIME_WALL) {
+        return (uint64_t)((double)(vtime_host_ns() - vtime->wall_start) * vtime->freq / 1e9);
+    }
+    return vtime_instret_to_cycle(vtime, riscv->instret) + vtime->idle;
+}
+
+// scheduling a pending fn and arg again moves it
+void vtime_schedule(riscv_t *riscv, uint64_t cycle, vtime_fn_t fn, void *arg) {
+    vtime_t *vtime = &riscv->vtime;
+    int i = vtime_find(vtime, fn, arg);
+    if (i >= 0) {
+        vtime_remove(vtime, (uint32_t)i);
+    }
+
+    if (vtime->event_num == vtime->event_size) {
+        uint32_t size = vtime->event_size ? vtime->event_size * 2 : VTIME_EVENT_INIT_SIZE;
+        vtime_event_t *events = realloc(vtime->events, size * sizeof(vtime_event_t));
+        if (!events) {
+            fprintf(stderr, "alloc vtime events failed\n");
+            exit(-1);
+        }
+        vtime->events = events;
+        vtime->event_size = size;
+    }
+
+    vtime_event_t *event = &vtime->events[vtime->event_num];
+    event->cycle = cycle;
+    event->seq = vtime->seq++;
+    event->fn = fn;
+    event->arg = arg;
+    vtime_sift_up(vtime, vtime->event_num++);
+    vtime_rearm(riscv);
+}
+
+void vtime_cancel(riscv_t *riscv, vtime_fn_t fn, void *arg) {
+    vtime_t *vtime = &riscv->vtime;
+    int i = vtime_find(vtime, fn, arg);
+    if (i < 0) {
+        return;
+    }
+
+    vtime_remove(vtime, (uint32_t)i);
+    vtime_rearm(riscv);
+}
+
+// callbacks get the cycle they were scheduled for, not the later one they run at,
+// so periodic events do not drift by the length of the block that crossed them
+void vtime_poll(riscv_t *riscv) {
+    vtime_t *vtime = &riscv->vtime;
+    uint64_t now = vtime_now(riscv);
+    if (__atomic_exchange_n(&vtime->kicked, 0, __ATOMIC_SEQ_CST)) {
+        for (int i = 0; i < vtime->kick_num; i++) {
+            vtime->kicks[i].fn(vtime->kicks[i].arg, now);
+        }
+    }
+    while (vtime->event_num && vtime->events[0].cycle <= now) {
+        vtime_event_t event = vtime->events[0];
+        vtime_remove(vtime, 0);
+        vtime->fired++;
+        event.fn(event.arg, event.cycle); // may schedule again
+    }
+    vtime_rearm(riscv);
+}
+
+// moves the clock to cycle without retiring anything, then fires what is due
+// virtual time jumps there, wall time sleeps the host, at most VTIME_SLEEP_MAX_MS at once
+void vtime_advance(riscv_t *riscv, uint64_t cycle) {
+    vtime_t *vtime = &riscv->vtime;
+    uint64_t now = vtime_now(riscv);
+    if (cycle > now) {
+        if (vtime->mode == VTIME_WALL) {
+            uint64_t ms = (cycle - now) * 1000 / vtime->freq;
+            thread_msleep(ms == 0 ? 1 : (ms > VTIME_SLEEP_MAX_MS ? VTIME_SLEEP_MAX_MS : (int)ms));
+        } else {
+            vtime->idle += cycle - now;
+        }
+    }
+    vtime_poll(riscv);
+}
+
+// fn runs on the cpu thread at the next block after any vtime_kick, it usually schedules an event
+void vtime_on_kick(riscv_t *riscv, vtime_fn_t fn, void *arg) {
+    vtime_t *vtime = &riscv->vtime;
+    if (vtime->kick_num == VTIME_KICK_MAX) {
+        fprintf(stderr, "too many vtime kick handlers\n");
+        return;
+    }
+    vtime->kicks[vtime->kick_num].fn = fn;
+    vtime->kicks[vtime->kick_num].arg = arg;
+    vtime->kick_num++;
+}
+
+// the only vtime call safe from other threads, they hand data over and wake the cpu side
+void vtime_kick(riscv_t *riscv) {
+    vtime_t *vtime = &riscv->vtime;
+    __atomic_store_n(&vtime->kicked, 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&vtime->check, 0, __ATOMIC_SEQ_CST);
+}
+
+void vtime_report(riscv_t *riscv, FILE *file) {
+    vtime_t *vtime = &riscv->vtime;
+    uint64_t now = vtime_now(riscv);
+    fprintf(file, "%s time: %llu instrs, %llu cycles, %.3f ms at %llu hz, ipc %.2f\n",
+            vtime->mode == VTIME_WALL ? "wall" : "virtual",
+            (unsigned long long)riscv->instret, (unsigned long long)now,
+            1000.0 * now / vtime->freq, (unsigned long long)vtime->freq,
+            (double)vtime->ipc / VTIME_IPC_ONE);
+    fprintf(file, "  events: %llu fired, %u pending\n", (unsigned long long)vtime->fired, vtime->event_num);
+    fprintf(file, "  idle: %llu wfi, %llu cycles skipped\n", (unsigned long long)riscv->wfi_num,
+            (unsigned long long)vtime->idle);
+}
@@ -0,0 +1,63 @@
+#ifndef VTIME_H
+#define VTIME_H
+
+#include <stdio.h>
+#include "core/types.h"
+
+#define VTIME_VIRTUAL   0 // time is retired instrs divided by ipc, runs are reproducible
+#define VTIME_WALL      1 // time follows the host clock
+
+#define VTIME_IPC_ONE       65536       // ipc is 16.16 fixed point
+#define VTIME_WALL_POLL     4096        // instrs between host clock reads in wall mode
+#define VTIME_NEVER         UINT64_MAX
+#define VTIME_EVENT_INIT_SIZE   16
+#define VTIME_KICK_MAX      8
+#define VTIME_SLEEP_MAX_MS  10          // longest host sleep while idle, keeps gdb pause responsive
+
+struct _riscv_t;
+
+// called from the run loop once the guest clock reaches cycle
+typedef void (*vtime_fn_t)(void *arg, uint64_t cycle);
+
+// fn and arg together name an event, a device has at most one pending per pair
+typedef struct _vtime_event_t {
+    uint64_t cycle;
+    uint64_t seq;           // schedule order, breaks ties so runs stay reproducible
+    vtime_fn_t fn;
+    void *arg;
+}vtime_event_t;
+
+typedef struct _vtime_kick_t {
+    vtime_fn_t fn;
+    void *arg;
+}vtime_kick_t;
+
+typedef struct _vtime_t {
+    int mode;
+    uint64_t freq;          // guest core clock in hz
+    uint32_t ipc;           // retired instrs per core cycle, 16.16
+    uint64_t check;         // instret at which the run loop calls vtime_poll
+    uint64_t wall_start;    // host ns when wall mode was entered
+    uint64_t idle;          // cycles skipped by vtime_advance in virtual mode
+    uint64_t deadline;      // core cycle of the earliest event, VTIME_NEVER if none
+    vtime_event_t *events;  // min heap on cycle then seq
+    uint32_t event_num;
+    uint32_t event_size;
+    uint64_t seq;
+    uint64_t fired;
+    int kicked;             // set by host threads, the run loop polls at the next block
+    vtime_kick_t kicks[VTIME_KICK_MAX];
+    int kick_num;
+}vtime_t;
+
+void vtime_init(struct _riscv_t *riscv, int mode, uint64_t freq, uint32_t ipc);
+uint64_t vtime_now(struct _riscv_t *riscv);
+void vtime_schedule(struct _riscv_t *riscv, uint64_t cycle, vtime_fn_t fn, void *arg);
+void vtime_cancel(struct _riscv_t *riscv, vtime_fn_t fn, void *arg);
+void vtime_poll(struct _riscv_t *riscv);
+void vtime_advance(struct _riscv_t *riscv, uint64_t cycle);
+void vtime_on_kick(struct _riscv_t *riscv, vtime_fn_t fn, void *arg);
+void vtime_kick(struct _riscv_t *riscv);
+void vtime_report(struct _riscv_t *riscv, FILE *file);
+
+#endif
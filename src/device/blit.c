@@ -0,0 +1,217 @@
+#include "device/blit.h"
+#include <stdlib.h>
+#include <string.h>
+#include "core/riscv.h"
+#include "device/pfic.h"
+#include "device/lcd.h"
+
+static const char *blit_op_names[BLIT_OP_NUM] = {"fill", "copy", "copy_key"};
+
+device_t *blit_create(const char *name, riscv_word_t base) {
+    blit_t *blit = calloc(1, sizeof(blit_t));
+    device_init(&blit->device, name, 0, base, sizeof(blit_reg_t));
+    blit->device.read = blit_read;
+    blit->device.write = blit_write;
+    return &blit->device;
+}
+
+static void blit_done(void *arg, uint64_t cycle) {
+    blit_t *blit = (blit_t *)arg;
+    blit->regs.status &= ~BLIT_STATUS_BUSY;
+    blit->regs.status |= BLIT_STATUS_DONE;
+    if (blit->regs.ctrl & BLIT_CTRL_IE) {
+        pfic_set_irq_pending(blit->device.riscv->pfic, BLIT_IRQ);
+        blit->irqs++;
+    }
+}
+
+static inline uint32_t blit_bpp(blit_t *blit) {
+    return blit->regs.format == LCD_FORMAT_RGB565 ? 2 : 4;
+}
+
+// the first row is written pixel by pixel, a loop the compiler vectorizes,
+// every other row is a memcpy of it
+static void blit_fill(blit_t *blit, uint8_t *dst) {
+    blit_reg_t *regs = &blit->regs;
+    if (blit_bpp(blit) == 2) {
+        uint16_t *row = (uint16_t *)dst;
+        for (uint32_t x = 0; x < regs->width; x++) {
+            row[x] = (uint16_t)regs->color;
+        }
+    } else {
+        uint32_t *row = (uint32_t *)dst;
+        for (uint32_t x = 0; x < regs->width; x++) {
+            row[x] = regs->color;
+        }
+    }
+    for (uint32_t y = 1; y < regs->height; y++) {
+        memcpy(dst + (size_t)y * regs->dst_stride, dst, (size_t)regs->width * blit_bpp(blit));
+    }
+}
+
+// right to left when back is set, so a row moved right within itself is not smeared
+#define BLIT_COPY_KEY(type, d, s, width, key, back) \
+    for (uint32_t i = 0; i < (width); i++) { \
+        uint32_t x = (back) ? (width) - 1 - i : i; \
+        if (((const type *)(s))[x] != (type)(key)) { \
+            ((type *)(d))[x] = ((const type *)(s))[x]; \
+        } \
+    }
+
+// rows go bottom up and COPY_KEY pixels right to left when dst is past src, so scrolling
+// within one buffer works, blit_start turns away overlaps this order can not handle
+static void blit_copy(blit_t *blit, uint8_t *dst, const uint8_t *src) {
+    blit_reg_t *regs = &blit->regs;
+    size_t len = (size_t)regs->width * blit_bpp(blit);
+    int up = dst > src;
+    for (uint32_t i = 0; i < regs->height; i++) {
+        uint32_t y = up ? regs->height - 1 - i : i;
+        uint8_t *d = dst + (size_t)y * regs->dst_stride;
+        const uint8_t *s = src + (size_t)y * regs->src_stride;
+        if (regs->op == BLIT_OP_COPY) {
+            memmove(d, s, len);
+        } else if (blit_bpp(blit) == 2) {
+            BLIT_COPY_KEY(uint16_t, d, s, regs->width, regs->color, up);
+        } else {
+            BLIT_COPY_KEY(uint32_t, d, s, regs->width, regs->color, up);
+        }
+    }
+}
+
+static inline uint64_t blit_rect_size(blit_t *blit, uint32_t stride) {
+    return (uint64_t)(blit->regs.height - 1) * stride + (uint64_t)blit->regs.width * blit_bpp(blit);
+}
+
+// copies keep their order right only for overlapping rects whose rows line up
+static int blit_bad_overlap(blit_t *blit, const uint8_t *dst, const uint8_t *src) {
+    blit_reg_t *regs = &blit->regs;
+    return regs->op != BLIT_OP_FILL && regs->height > 1 && regs->src_stride != regs->dst_stride &&
+           dst < src + blit_rect_size(blit, regs->src_stride) && src < dst + blit_rect_size(blit, regs->dst_stride);
+}
+
+// guest range of a rect, NULL if it is not all in one memory or its rows would overlap
+// sizes are 64 bit, a guest width must not wrap them into a small range
+static uint8_t *blit_rect(blit_t *blit, riscv_word_t addr, uint32_t stride, int is_dst) {
+    riscv_t *riscv = blit->device.riscv;
+    blit_reg_t *regs = &blit->regs;
+    uint32_t bpp = blit_bpp(blit);
+    uint64_t row = (uint64_t)regs->width * bpp;
+    if (row > UINT32_MAX || (addr | stride) & (bpp - 1) || (regs->height > 1 && stride < row)) {
+        return NULL;
+    }
+
+    uint64_t size = blit_rect_size(blit, stride);
+    device_t *flash_dev = &riscv->flash->device;
+    if (size > UINT32_MAX || (is_dst && addr < flash_dev->end && addr + size > flash_dev->base)) {
+        return NULL; // stores into flash would have to flush decoded code
+    }
+    return riscv_mem_host(riscv, addr, (riscv_word_t)size);
+}
+
+// the host does the whole op at once, the guest sees it busy for as long as the
+// controller would take, DONE and the irq come at the end of that
+static void blit_start(blit_t *blit) {
+    riscv_t *riscv = blit->device.riscv;
+    blit_reg_t *regs = &blit->regs;
+    if (regs->status & BLIT_STATUS_BUSY) {
+        regs->status |= BLIT_STATUS_ERR; // ignored, the running op carries on
+        blit->errors++;
+        return;
+    }
+
+    uint64_t pixels = (uint64_t)regs->width * regs->height;
+    if (pixels) {
+        uint8_t *dst = blit_rect(blit, regs->dst, regs->dst_stride, 1);
+        uint8_t *src = regs->op == BLIT_OP_FILL ? dst : blit_rect(blit, regs->src, regs->src_stride, 0);
+        if (!dst || !src || regs->op >= BLIT_OP_NUM || blit_bad_overlap(blit, dst, src)) {
+            regs->status |= BLIT_STATUS_ERR;
+            blit->errors++;
+            pixels = 0;
+        } else if (regs->op == BLIT_OP_FILL) {
+            blit_fill(blit, dst);
+        } else {
+            blit_copy(blit, dst, src);
+        }
+    }
+    if (pixels) {
+        blit->ops[regs->op]++;
+        blit->pixels += pixels;
+    }
+
+    regs->status |= BLIT_STATUS_BUSY;
+    uint64_t cycles = BLIT_SETUP_CYCLES + pixels / BLIT_PIXELS_PER_CYCLE;
+    vtime_schedule(riscv, vtime_now(riscv) + cycles, blit_done, blit);
+}
+
+void blit_report(device_t *device, FILE *file) {
+    blit_t *blit = (blit_t *)device;
+    fprintf(file, "%s: %llu pixels, %llu errors, %llu irqs\n", device->name,
+            (unsigned long long)blit->pixels, (unsigned long long)blit->errors, (unsigned long long)blit->irqs);
+    fprintf(file, "  ops:");
+    for (int i = 0; i < BLIT_OP_NUM; i++) {
+        fprintf(file, " %s %llu", blit_op_names[i], (unsigned long long)blit->ops[i]);
+    }
+    fprintf(file, "\n");
+}
+
+int blit_read(device_t *device, riscv_word_t addr, uint8_t *data, int size) {
+    blit_t *blit = (blit_t *)device;
+    riscv_word_t offset = addr - device->base;
+    if (offset + size > sizeof(blit_reg_t)) {
+        return -1;
+    }
+
+    memcpy(data, (uint8_t *)&blit->regs + offset, size);
+    return 0;
+}
+
+int blit_write(device_t *device, riscv_word_t addr, uint8_t *data, int size) {
+    blit_t *blit = (blit_t *)device;
+    blit_reg_t *regs = &blit->regs;
+    riscv_word_t offset = addr - device->base;
+    uint32_t val = 0;
+    memcpy(&val, data, size > 4 ? 4 : size);
+
+    switch (offset) {
+        case BLIT_CTRL_OFF:
+            regs->ctrl = val & ~BLIT_CTRL_START;
+            if (val & BLIT_CTRL_START) {
+                blit_start(blit);
+            }
+            break;
+        case BLIT_STATUS_OFF:
+            regs->status &= ~(val & (BLIT_STATUS_DONE | BLIT_STATUS_ERR));
+            break;
+        case BLIT_OP_OFF:
+            regs->op = val;
+            break;
+        case BLIT_SRC_OFF:
+            regs->src = val;
+            break;
+        case BLIT_SRC_STRIDE_OFF:
+            regs->src_stride = val;
+            break;
+        case BLIT_DST_OFF:
+            regs->dst = val;
+            break;
+        case BLIT_DST_STRIDE_OFF:
+            regs->dst_stride = val;
+            break;
+        case BLIT_WIDTH_OFF:
+            regs->width = val;
+            break;
+        case BLIT_HEIGHT_OFF:
+            regs->height = val;
+            break;
+        case BLIT_COLOR_OFF:
+            regs->color = val;
+            break;
+        case BLIT_FORMAT_OFF:
+            regs->format = val;
+            break;
+        default:
+            return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,68 @@
+#ifndef BLIT_H
+#define BLIT_H
+
+#include "device/device.h"
+#include <stdint.h>
+#include <stdio.h>
+
+// 2d engine next to the lcd, fills and copies rects of 32 or 16 bit pixels in guest memory
+// modeled on the dma2d style controllers: set up the regs, write START, wait for DONE or the irq
+#define BLIT_BASE           0xA0001000
+#define BLIT_IRQ            104         // first number past the ch32v307 vector table
+
+#define BLIT_CTRL_OFF       0x00
+#define BLIT_STATUS_OFF     0x04
+#define BLIT_OP_OFF         0x08
+#define BLIT_SRC_OFF        0x0C
+#define BLIT_SRC_STRIDE_OFF 0x10        // bytes from one row to the next
+#define BLIT_DST_OFF        0x14
+#define BLIT_DST_STRIDE_OFF 0x18
+#define BLIT_WIDTH_OFF      0x1C        // pixels
+#define BLIT_HEIGHT_OFF     0x20        // rows
+#define BLIT_COLOR_OFF      0x24        // fill color, or the transparent color of COPY_KEY
+#define BLIT_FORMAT_OFF     0x28        // pixel layout, the LCD_FORMAT_* values
+
+#define BLIT_CTRL_START     (1 << 0)
+#define BLIT_CTRL_IE        (1 << 1)    // irq on completion
+
+#define BLIT_STATUS_BUSY    (1 << 0)
+#define BLIT_STATUS_DONE    (1 << 1)    // write 1 to clear
+#define BLIT_STATUS_ERR     (1 << 2)    // bad rect or started while busy, write 1 to clear
+
+#define BLIT_OP_FILL        0
+#define BLIT_OP_COPY        1
+#define BLIT_OP_COPY_KEY    2           // copy, skipping source pixels equal to COLOR
+#define BLIT_OP_NUM         3
+
+#define BLIT_PIXELS_PER_CYCLE   4       // guest side duration, the host is done at START
+#define BLIT_SETUP_CYCLES       32
+
+typedef struct _blit_reg_t {
+    uint32_t ctrl;
+    uint32_t status;
+    uint32_t op;
+    uint32_t src;
+    uint32_t src_stride;
+    uint32_t dst;
+    uint32_t dst_stride;
+    uint32_t width;
+    uint32_t height;
+    uint32_t color;
+    uint32_t format;
+}blit_reg_t;
+
+typedef struct _blit_t {
+    device_t device;
+    blit_reg_t regs;
+    uint64_t ops[BLIT_OP_NUM];
+    uint64_t pixels;
+    uint64_t errors;
+    uint64_t irqs;
+}blit_t;
+
+device_t *blit_create(const char *name, riscv_word_t base);
+void blit_report(device_t *device, FILE *file);
+int blit_read(device_t *device, riscv_word_t addr, uint8_t *data, int size);
+int blit_write(device_t *device, riscv_word_t addr, uint8_t *data, int size);
+
+#endif
@@ -12,8 +12,23 @@ typedef struct _device_t {
 
     struct _device_t *next;
     struct _riscv_t *riscv;
+    uint8_t *mem;   // host memory backing the whole range, NULL for mmio
     int (*read)(struct _device_t *device, riscv_word_t addr, uint8_t *data, int size);
     int (*write)(struct _device_t *device, riscv_word_t addr, uint8_t *data, int size);
+
+    // optional fast paths for single loads and stores, NULL falls back to read/write
+    uint8_t (*read8)(struct _device_t *device, riscv_word_t addr);
+    uint16_t (*read16)(struct _device_t *device, riscv_word_t addr);
+    uint32_t (*read32)(struct _device_t *device, riscv_word_t addr);
+    void (*write8)(struct _device_t *device, riscv_word_t addr, uint8_t val);
+    void (*write16)(struct _device_t *device, riscv_word_t addr, uint16_t val);
+    void (*write32)(struct _device_t *device, riscv_word_t addr, uint32_t val);
+
+    // optional, called once riscv is set so the device can schedule its first events
+    void (*attach)(struct _device_t *device);
+    // optional, nonzero if reading addr gives a new value as time passes without any event
+    // busy waits on such a register are never skipped
+    int (*timed)(struct _device_t *device, riscv_word_t addr);
 }device_t;
 
 void device_init(device_t *device, const char *name, riscv_word_t attr,
@@ -1,12 +1,324 @@
 #include <SDL.h>
 #include <stdio.h>
-#include "plat/plat.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include "device/lcd.h"
+#include "core/riscv.h"
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
-static Uint32 user_event;
+// rgb565 is widened by copying the top bits of each channel into the new low bits
+void lcd_rgb565_to_argb_c(uint32_t *dst, const uint16_t *src, int n) {
+    for (int i = 0; i < n; i++) {
+        uint32_t v = src[i];
+        dst[i] = 0xff000000 | ((v << 8) & 0xf80000) | ((v << 3) & 0x070000)
+               | ((v << 5) & 0xfc00) | ((v >> 1) & 0x0300)
+               | ((v << 3) & 0xf8) | ((v >> 2) & 0x07);
+    }
+}
+
+#if defined(__SSE2__)
+// the same shifts and masks on 32 bit lanes, the pixels are zero extended first
+#define LCD_RGB565_LANES(v, set1, and, or, sll, srl) \
+    or(or(or(set1(0xff000000), or(and(sll(v, 8), set1(0xf80000)), and(sll(v, 3), set1(0x070000)))), \
+          or(and(sll(v, 5), set1(0xfc00)), and(srl(v, 1), set1(0x0300)))), \
+       or(and(sll(v, 3), set1(0xf8)), and(srl(v, 2), set1(0x07))))
+
+void lcd_rgb565_to_argb_sse2(uint32_t *dst, const uint16_t *src, int n) {
+    __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i p = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i lo = _mm_unpacklo_epi16(p, zero);
+        __m128i hi = _mm_unpackhi_epi16(p, zero);
+        _mm_storeu_si128((__m128i *)(dst + i),
+                         LCD_RGB565_LANES(lo, _mm_set1_epi32, _mm_and_si128, _mm_or_si128, _mm_slli_epi32, _mm_srli_epi32));
+        _mm_storeu_si128((__m128i *)(dst + i + 4),
+                         LCD_RGB565_LANES(hi, _mm_set1_epi32, _mm_and_si128, _mm_or_si128, _mm_slli_epi32, _mm_srli_epi32));
+    }
+    lcd_rgb565_to_argb_c(dst + i, src + i, n - i);
+}
 
-void thread_entry (void *arg) {
-    lcd_t * lcd = (lcd_t *)arg;
+__attribute__((target("avx2")))
+void lcd_rgb565_to_argb_avx2(uint32_t *dst, const uint16_t *src, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(src + i)));
+        _mm256_storeu_si256((__m256i *)(dst + i),
+                            LCD_RGB565_LANES(v, _mm256_set1_epi32, _mm256_and_si256, _mm256_or_si256, _mm256_slli_epi32, _mm256_srli_epi32));
+    }
+    lcd_rgb565_to_argb_c(dst + i, src + i, n - i);
+}
+#endif
+
+// picked once, avx2 where the host has it, sse2 is part of every x86_64
+static void (*lcd_rgb565_to_argb)(uint32_t *dst, const uint16_t *src, int n) = lcd_rgb565_to_argb_c;
+
+static void lcd_pick_convert(void) {
+#if defined(__SSE2__)
+    __builtin_cpu_init();
+    lcd_rgb565_to_argb = __builtin_cpu_supports("avx2") ? lcd_rgb565_to_argb_avx2 : lcd_rgb565_to_argb_sse2;
+#endif
+}
+
+static inline uint8_t *lcd_pixel(lcd_t *lcd, uint8_t *buf, int x, int y) {
+    return buf + ((size_t)y * lcd->width + x) * lcd->bpp;
+}
+
+static void lcd_clean(lcd_t *lcd, int y) {
+    lcd->dirty_x0[y] = lcd->width;
+    lcd->dirty_x1[y] = -1;
+}
+
+// stores reach the frame buffer without coming through here, so what changed is found
+// by comparing it with the frame last shown, rows that match cost a memcmp
+static void lcd_diff(lcd_t *lcd) {
+    int row = lcd->width * lcd->bpp;
+    lcd->dirty_y0 = lcd->height;
+    lcd->dirty_y1 = -1;
+    for (int y = 0; y < lcd->height; y++) {
+        uint8_t *cur = lcd_pixel(lcd, lcd->frame_buf, 0, y);
+        uint8_t *shown = lcd_pixel(lcd, lcd->shown, 0, y);
+        if (memcmp(cur, shown, row) == 0) {
+            continue;
+        }
+
+        int b0 = 0, b1 = row - 1;
+        while (cur[b0] == shown[b0]) {
+            b0++;
+        }
+        while (cur[b1] == shown[b1]) {
+            b1--;
+        }
+        lcd->dirty_x0[y] = b0 / lcd->bpp;
+        lcd->dirty_x1[y] = b1 / lcd->bpp;
+        if (y < lcd->dirty_y0) {
+            lcd->dirty_y0 = y;
+        }
+        lcd->dirty_y1 = y;
+    }
+}
+
+// the shown frame catches up with the dirty spans
+static void lcd_clean_all(lcd_t *lcd) {
+    for (int y = lcd->dirty_y0; y <= lcd->dirty_y1; y++) {
+        int x0 = lcd->dirty_x0[y], len = lcd->dirty_x1[y] - x0 + 1;
+        if (len > 0) {
+            memcpy(lcd_pixel(lcd, lcd->shown, x0, y), lcd_pixel(lcd, lcd->frame_buf, x0, y), len * lcd->bpp);
+        }
+        lcd_clean(lcd, y);
+    }
+    lcd->dirty_y0 = lcd->height;
+    lcd->dirty_y1 = -1;
+}
+
+// the texture is always argb8888, rgb565 rects are widened into lcd->argb on the way
+static void lcd_upload_rect(lcd_t *lcd, SDL_Rect *rect) {
+    uint8_t *pixels = lcd_pixel(lcd, lcd->frame_buf, rect->x, rect->y);
+    if (lcd->format == LCD_FORMAT_RGB565) {
+        for (int y = rect->y; y < rect->y + rect->h; y++) {
+            lcd_rgb565_to_argb(&lcd->argb[y * lcd->width + rect->x],
+                               (const uint16_t *)lcd_pixel(lcd, lcd->frame_buf, rect->x, y), rect->w);
+        }
+        pixels = (uint8_t *)&lcd->argb[rect->y * lcd->width + rect->x];
+    }
+    SDL_UpdateTexture(lcd->texture, rect, pixels, lcd->width * sizeof(uint32_t));
+    lcd->pixels_uploaded += (uint64_t)rect->w * rect->h;
+}
+
+// a run of dirty rows goes up as one rect over the union of their spans, as long as
+// each span touches the union so far, a row off to the side starts a rect of its own
+static void lcd_upload(lcd_t *lcd) {
+    int y = lcd->dirty_y0;
+    while (y <= lcd->dirty_y1) {
+        if (lcd->dirty_x0[y] > lcd->dirty_x1[y]) {
+            y++;
+            continue;
+        }
+
+        int x0 = lcd->dirty_x0[y], x1 = lcd->dirty_x1[y], y1 = y;
+        while (y1 + 1 <= lcd->dirty_y1 && lcd->dirty_x0[y1 + 1] <= lcd->dirty_x1[y1 + 1]
+               && lcd->dirty_x0[y1 + 1] <= x1 + 1 && lcd->dirty_x1[y1 + 1] >= x0 - 1) {
+            y1++;
+            x0 = lcd->dirty_x0[y1] < x0 ? lcd->dirty_x0[y1] : x0;
+            x1 = lcd->dirty_x1[y1] > x1 ? lcd->dirty_x1[y1] : x1;
+        }
+
+        SDL_Rect rect = {x0, y, x1 - x0 + 1, y1 - y + 1};
+        lcd_upload_rect(lcd, &rect);
+        y = y1 + 1;
+    }
+}
+
+static void lcd_render(lcd_t *lcd) {
+    SDL_RenderCopy(lcd->renderer, lcd->texture, NULL, NULL);
+    SDL_RenderPresent(lcd->renderer);
+}
+
+static void lcd_capture_write(lcd_t *lcd, const void *data, size_t size) {
+    fwrite(data, 1, size, lcd->capture);
+    lcd->capture_bytes += size;
+}
+
+// the dirty spans are exact, rewriting a pixel with the value it had is not a change,
+// so captures of the same run compare byte for byte
+static void lcd_capture(lcd_t *lcd) {
+    int key = lcd->frames % LCD_CAPTURE_KEY_INTERVAL == 0;
+    int y0 = key ? 0 : lcd->dirty_y0;
+    int y1 = key ? lcd->height - 1 : lcd->dirty_y1;
+    uint32_t run_num = 0;
+    for (int y = y0; y <= y1; y++) {
+        run_num += key || lcd->dirty_x0[y] <= lcd->dirty_x1[y];
+    }
+
+    lcd_frame_header_t header = {LCD_FRAME_MAGIC, key ? LCD_FRAME_KEY : LCD_FRAME_DELTA, lcd->frames,
+                                 vtime_now(lcd->device.riscv), run_num, 0};
+    lcd_capture_write(lcd, &header, sizeof(header));
+    for (int y = y0; y <= y1; y++) {
+        int x0 = key ? 0 : lcd->dirty_x0[y];
+        int len = key ? lcd->width : lcd->dirty_x1[y] - x0 + 1;
+        if (len <= 0) {
+            continue;
+        }
+        lcd_run_t run = {(uint16_t)x0, (uint16_t)y, (uint16_t)len, 0};
+        lcd_capture_write(lcd, &run, sizeof(run));
+        lcd_capture_write(lcd, lcd_pixel(lcd, lcd->frame_buf, x0, y), len * lcd->bpp);
+    }
+    fflush(lcd->capture); // a reader on a pipe sees every frame as it is flushed
+
+    lcd->frames++;
+    lcd->key_frames += key;
+}
+
+// a flush that changed nothing costs a compare and its capture header
+static void lcd_present(lcd_t *lcd) {
+    lcd->flushes++;
+    lcd_diff(lcd);
+    if (lcd->capture) {
+        lcd_capture(lcd);
+    }
+    if (lcd->dirty_y0 > lcd->dirty_y1) {
+        lcd->flushes_clean++;
+        return;
+    }
+
+    if (!lcd->headless) {
+        lcd_upload(lcd);
+        lcd_render(lcd);
+    }
+    lcd_clean_all(lcd);
+}
+
+static void lcd_brush(lcd_t *lcd, int x, int y) {
+    int r = LCD_BRUSH_RADIUS;
+    for (int w = -r; w <= r; w++) {
+        for (int h = -r; h <= r; h++) {
+            if (w * w + h * h <= r * r) {
+                SDL_RenderDrawPoint(lcd->renderer, x + w, y + h);
+            }
+        }
+    }
+}
+
+static void lcd_mouse_motion(lcd_t *lcd, int x, int y) {
+    lcd->regs.mousex = x;
+    lcd->regs.mousey = y;
+
+    if (!lcd->regs.mouse_st) {
+        lcd->last_x = -1;
+        lcd->last_y = -1;
+        return;
+    }
+
+    SDL_SetRenderDrawColor(lcd->renderer, 0, 0, 0, 255);
+    if (lcd->last_x != -1 && lcd->last_y != -1) {
+        int dx = x - lcd->last_x;
+        int dy = y - lcd->last_y;
+        float distance = (float)sqrt(dx * dx + dy * dy);
+
+        for (float i = 0; i <= distance; i += 1.0f) {
+            float t = i / distance;
+            lcd_brush(lcd, (int)(lcd->last_x + t * dx), (int)(lcd->last_y + t * dy));
+        }
+    }
+
+    lcd->last_x = x;
+    lcd->last_y = y;
+    lcd_brush(lcd, x, y);
+    SDL_RenderPresent(lcd->renderer);
+}
+
+// runs on the cpu thread from the event queue, it used to be a host thread of its own
+static void lcd_poll(void *arg, uint64_t cycle) {
+    lcd_t *lcd = (lcd_t *)arg;
+    riscv_t *riscv = lcd->device.riscv;
+
+    SDL_Event event;
+    while (SDL_PollEvent(&event)) {
+        if (event.type == SDL_QUIT) {
+            return; // window closed, stop polling it
+        } else if (event.type == SDL_MOUSEMOTION) {
+            lcd_mouse_motion(lcd, event.motion.x, event.motion.y);
+        } else if (event.type == SDL_MOUSEBUTTONUP) {
+            lcd->regs.mouse_st = 0;
+        } else if (event.type == SDL_MOUSEBUTTONDOWN) {
+            lcd->regs.mouse_st = 1;
+        } else if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_EXPOSED) {
+            lcd_render(lcd); // the texture is still current, only the window lost it
+        }
+    }
+
+    vtime_schedule(riscv, cycle + riscv->vtime.freq / LCD_POLL_HZ, lcd_poll, lcd);
+}
+
+static void lcd_attach(device_t *device) {
+    riscv_t *riscv = device->riscv;
+    riscv_add_device(riscv, &((lcd_t *)device)->fb->device);
+    if (((lcd_t *)device)->headless) {
+        return; // no window to poll
+    }
+    vtime_schedule(riscv, vtime_now(riscv) + riscv->vtime.freq / LCD_POLL_HZ, lcd_poll, device);
+}
+
+// headless needs no display, flushes only feed the capture file and the counters
+// format is how the guest lays out pixels, the window is argb8888 either way
+device_t *lcd_create(const char *name, int width, int height, int format, int headless) {
+    lcd_t *lcd = calloc(1, sizeof(lcd_t));
+    device_init(&lcd->device, name, 0, LCD_BASE, sizeof(lcd_reg_t));
+    lcd->format = format;
+    lcd->bpp = format == LCD_FORMAT_RGB565 ? 2 : 4;
+
+    // the frame buffer is plain memory, guest stores go straight to it like ram
+    // rounded up to whole pages so none of it falls back to the slow path
+    char fb_name[64];
+    riscv_word_t fb_size = width * height * lcd->bpp;
+    riscv_word_t page = mem_page_size();
+    snprintf(fb_name, sizeof(fb_name), "%s_fb", name);
+    lcd->fb = mem_create(fb_name, MEM_ATTR_READABLE | MEM_ATTR_WRITABLE | MEM_ATTR_DEVICE, LCD_BUF_BASE,
+                         (fb_size + page - 1) & ~(page - 1));
+    if (!lcd->fb) {
+        exit(-1);
+    }
+    lcd->frame_buf = lcd->fb->mem;
+    lcd->shown = calloc(width * height, lcd->bpp);
+    lcd->width = width;
+    lcd->height = height;
+    lcd->last_x = -1;
+    lcd->last_y = -1;
+    lcd->dirty_x0 = calloc(height, sizeof(int));
+    lcd->dirty_x1 = calloc(height, sizeof(int));
+    lcd->dirty_y0 = 0;
+    lcd->dirty_y1 = height - 1;
+    lcd_clean_all(lcd);
+    lcd->headless = headless;
+    lcd->device.read = lcd_read;
+    lcd->device.write = lcd_write;
+    lcd->device.attach = lcd_attach;
+    if (headless) {
+        return &lcd->device;
+    }
 
     if (SDL_Init(SDL_INIT_VIDEO) != 0) {
         fprintf(stderr, "SDL initialization failed: %s\n", SDL_GetError());
@@ -14,120 +326,73 @@ void thread_entry (void *arg) {
     }
 
     // create window
-    SDL_Window *window = SDL_CreateWindow(lcd->device.name,
-                                          SDL_WINDOWPOS_CENTERED,
-                                          SDL_WINDOWPOS_CENTERED,
-                                          lcd->width, lcd->height,
-                                          SDL_WINDOW_SHOWN);
-    if (!window) {
+    lcd->window = SDL_CreateWindow(name,
+                                   SDL_WINDOWPOS_CENTERED,
+                                   SDL_WINDOWPOS_CENTERED,
+                                   width, height,
+                                   SDL_WINDOW_SHOWN);
+    if (!lcd->window) {
         fprintf(stderr, "Failed to create SDL window: %s\n", SDL_GetError());
         exit(-1);
     }
 
-    // create renderer
-    SDL_Renderer *renderer = SDL_CreateRenderer(window, -1,
-                                                 SDL_RENDERER_ACCELERATED |
-                                                 SDL_RENDERER_PRESENTVSYNC);
-    if (!renderer) {
+    // no vsync, presenting must not block the cpu thread
+    lcd->renderer = SDL_CreateRenderer(lcd->window, -1, SDL_RENDERER_ACCELERATED);
+    if (!lcd->renderer) {
         fprintf(stderr, "Failed to create SDL renderer: %s\n", SDL_GetError());
         exit(-1);
     }
 
     // create texture (without filling frame buffer, just an empty texture)
-    SDL_Texture *texture = SDL_CreateTexture(renderer,
-                                            SDL_PIXELFORMAT_ARGB8888,
-                                            SDL_TEXTUREACCESS_STREAMING,
-                                            lcd->width, lcd->height);
-    if (!texture) {
+    lcd->texture = SDL_CreateTexture(lcd->renderer,
+                                     SDL_PIXELFORMAT_ARGB8888,
+                                     SDL_TEXTUREACCESS_STREAMING,
+                                     width, height);
+    if (!lcd->texture) {
         fprintf(stderr, "Failed to create SDL texture: %s\n", SDL_GetError());
         exit(-1);
     }
 
-    // update texture (fill ing frame buffer)
-    SDL_UpdateTexture(texture, NULL, lcd->frame_buf, lcd->width * sizeof(uint32_t));
-    SDL_RenderCopy(renderer, texture, NULL, NULL);
-    SDL_RenderPresent(renderer);
-    
-    user_event = SDL_RegisterEvents(1);
+    if (format == LCD_FORMAT_RGB565) {
+        lcd->argb = calloc(width * height, sizeof(uint32_t));
+        lcd_pick_convert();
+    }
+    SDL_Rect rect = {0, 0, width, height};
+    lcd_upload_rect(lcd, &rect);
+    lcd_render(lcd);
+    return &lcd->device;
+}
+
+// frames from the next flush on go to path, the first is a key frame
+int lcd_set_capture(device_t *device, const char *path) {
+    lcd_t *lcd = (lcd_t *)device;
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "open lcd capture %s failed\n", path);
+        return -1;
+    }
 
-    SDL_Event event;
-    int running = 1;
-    int brush_radius = 8;
-    int last_x = -1, last_y = -1;
-    while (running) {
-        while (SDL_PollEvent(&event)) {
-            if (event.type == SDL_QUIT) {
-                running = 0;
-            } else if (event.type == user_event) {
-                SDL_UpdateTexture(texture, NULL, lcd->frame_buf, lcd->width * sizeof(uint32_t));
-                SDL_RenderCopy(renderer, texture, NULL, NULL);
-                SDL_RenderPresent(renderer);     
-            } else if (event.type == SDL_MOUSEMOTION) {
-                lcd->regs.mousex = event.motion.x;
-                lcd->regs.mousey = event.motion.y;
-
-                if (lcd->regs.mouse_st) {
-                    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-
-                    if (last_x != -1 && last_y != -1) {
-                        int dx = lcd->regs.mousex - last_x;
-                        int dy = lcd->regs.mousey - last_y;
-                        float distance = (float)sqrt(dx * dx + dy * dy);
-
-                        for (float i = 0; i <= distance; i += 1.0f) {
-                            float t = i / distance;
-                            int intermediate_x = (int)(last_x + t * dx);
-                            int intermediate_y = (int)(last_y + t * dy);
-
-                            for (int w = -brush_radius; w <= brush_radius; w++) {
-                                for (int h = -brush_radius; h <= brush_radius; h++) {
-                                    if (w * w + h * h <= brush_radius * brush_radius) {
-                                        SDL_RenderDrawPoint(renderer, intermediate_x + w, intermediate_y + h);
-                                    }
-                                }
-                            }
-                        }
-                    }
-
-                    last_x = lcd->regs.mousex;
-                    last_y = lcd->regs.mousey;
-
-                    for (int w = -brush_radius; w <= brush_radius; w++) {
-                        for (int h = -brush_radius; h <= brush_radius; h++) {
-                            if (w * w + h * h <= brush_radius * brush_radius) {
-                                SDL_RenderDrawPoint(renderer, lcd->regs.mousex + w, lcd->regs.mousey + h);
-                            }
-                        }
-                    }
-
-                    SDL_RenderPresent(renderer);
-                } else {
-                    last_x = -1;
-                    last_y = -1;
-                }
-
-
-            } else if (event.type == SDL_MOUSEBUTTONUP) {
-                lcd->regs.mouse_st = 0;
-            } else if (event.type == SDL_MOUSEBUTTONDOWN) {
-                lcd->regs.mouse_st = 1;
-            }
-        }
-        SDL_Delay(16);
-    }    
+    lcd->capture = file;
+    lcd->frames = 0;
+    lcd_capture_header_t header = {LCD_CAPTURE_MAGIC, LCD_CAPTURE_VERSION, (uint16_t)(lcd->bpp * 8), (uint32_t)lcd->width, (uint32_t)lcd->height};
+    lcd_capture_write(lcd, &header, sizeof(header));
+    fflush(file);
+    return 0;
 }
 
-device_t *lcd_create(const char *name, int width, int height) {
-    lcd_t *lcd = calloc(1, sizeof(lcd_t));
-    uint32_t *frame_buf = calloc(1, width * height * 4); // each pixel with 4 bytes
-    lcd->frame_buf = frame_buf;
-    device_init(&lcd->device, name, 0, LCD_BASE, LCD_BUF_BASE + width * height * 4 - LCD_BASE);
-    lcd->width = width;
-    lcd->height = height;
-    lcd->device.read = lcd_read;
-    lcd->device.write = lcd_write;
-    thread_create(thread_entry, lcd);
-    return &lcd->device;
+void lcd_report(device_t *device, FILE *file) {
+    lcd_t *lcd = (lcd_t *)device;
+    riscv_t *riscv = device->riscv;
+    double seconds = (double)vtime_now(riscv) / riscv->vtime.freq;
+
+    fprintf(file, "%s: %llu flushes, %llu with nothing changed, %.1f flushes per guest second, %llu pixels uploaded\n",
+            device->name, (unsigned long long)lcd->flushes, (unsigned long long)lcd->flushes_clean,
+            seconds > 0 ? lcd->flushes / seconds : 0.0, (unsigned long long)lcd->pixels_uploaded);
+    if (lcd->capture) {
+        fprintf(file, "  capture: %llu frames, %llu key, %llu bytes, %.0f bytes per frame\n",
+                (unsigned long long)lcd->frames, (unsigned long long)lcd->key_frames,
+                (unsigned long long)lcd->capture_bytes, lcd->frames ? (double)lcd->capture_bytes / lcd->frames : 0.0);
+    }
 }
 
 int lcd_read(device_t *device, riscv_word_t addr, uint8_t *data, int size) {
@@ -159,26 +424,21 @@ int lcd_read(device_t *device, riscv_word_t addr, uint8_t *data, int size) {
     return 0;
 }
 
+// only the registers, the frame buffer is a mem device of its own
 int lcd_write(device_t *device, riscv_word_t addr, uint8_t *data, int size) {
     lcd_t *lcd = (lcd_t*)device;
-    if (addr >= LCD_BUF_BASE) {
-        memcpy(&lcd->frame_buf[(addr - LCD_BUF_BASE) / 4], data, size);
-    } else {
-        riscv_word_t val = 0;
-        memcpy(&val, data, size);
-        riscv_word_t offset = addr - LCD_BASE;
-        switch (offset) {
-            case LCD_CTRL_OFF:
-                if (val & LCD_CTRL_FLUSH) {
-                    SDL_Event event;
-                    event.type = user_event;
-                    SDL_PushEvent(&event); // this notifies the SDL polling thread
-                }
-                break;
-            default:
-                return -1;
-                break;
-        }
+    riscv_word_t val = 0;
+    memcpy(&val, data, size);
+    riscv_word_t offset = addr - LCD_BASE;
+    switch (offset) {
+        case LCD_CTRL_OFF:
+            if (val & LCD_CTRL_FLUSH) {
+                lcd_present(lcd);
+            }
+            break;
+        default:
+            return -1;
+            break;
     }
 
     return 0;
@@ -2,6 +2,7 @@
 #define LCD_H
 
 #include "device/device.h"
+#include "device/mem.h"
 
 #define LCD_BASE            0xA0000000 // start of address of regs
 #define LCD_BUF_BASE        0xA1000000 // start of frame buffer
@@ -13,6 +14,48 @@
 
 #define LCD_CTRL_FLUSH      (1 << 0) // flush frame buffer
 
+#define LCD_FORMAT_ARGB8888 0
+#define LCD_FORMAT_RGB565   1
+
+#define LCD_POLL_HZ         60 // window events are handled this often in guest time
+#define LCD_BRUSH_RADIUS    8
+
+// capture file, little endian: an lcd_capture_header_t, then per flush an lcd_frame_header_t
+// followed by run_num runs, each an lcd_run_t and len pixels of bpp bits in the guest format
+// a key frame has a full width run for every row, a delta frame only the pixels that
+// changed since the previous frame, so a flush that changed nothing is a bare header
+#define LCD_CAPTURE_MAGIC   0x4344434c  // "LCDC"
+#define LCD_FRAME_MAGIC     0x4d415246  // "FRAM"
+#define LCD_CAPTURE_VERSION 1
+#define LCD_CAPTURE_KEY_INTERVAL 300    // frames between key frames, a reader can start at any of them
+
+#define LCD_FRAME_KEY       0
+#define LCD_FRAME_DELTA     1
+
+typedef struct _lcd_capture_header_t {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t bpp;
+    uint32_t width;
+    uint32_t height;
+}lcd_capture_header_t;
+
+typedef struct _lcd_frame_header_t {
+    uint32_t magic;
+    uint32_t type;
+    uint64_t index;
+    uint64_t cycle;     // guest core cycle of the flush
+    uint32_t run_num;
+    uint32_t reserved;
+}lcd_frame_header_t;
+
+typedef struct _lcd_run_t {
+    uint16_t x;
+    uint16_t y;
+    uint16_t len;
+    uint16_t reserved;
+}lcd_run_t;
+
 typedef struct _lcd_reg_t {
     uint32_t ctrl;
     uint32_t mousex;
@@ -20,15 +63,48 @@ typedef struct _lcd_reg_t {
     uint32_t mouse_st;
 }lcd_reg_t;
 
+struct SDL_Window;
+struct SDL_Renderer;
+struct SDL_Texture;
+
 typedef struct _LCD_t {
     device_t device;
-    uint32_t *frame_buf;
+    mem_t *fb;              // the frame buffer at LCD_BUF_BASE, a mem device on the load/store fast path
+    uint8_t *frame_buf;     // its host memory
+    uint8_t *shown;         // the frame as of the last flush, flushes diff against it
+    int format;             // guest pixel layout, LCD_FORMAT_*
+    int bpp;                // bytes per guest pixel
+    uint32_t *argb;         // rgb565 frames are widened here for the texture, NULL for argb8888
     int width, height;
     lcd_reg_t regs;
+    struct SDL_Window *window;
+    struct SDL_Renderer *renderer;
+    struct SDL_Texture *texture;
+    int last_x, last_y;     // previous brush point while the button is held, -1 if none
+    int *dirty_x0;          // per row, first and last pixel changed since the last flush
+    int *dirty_x1;          // x0 > x1 when the row is clean
+    int dirty_y0, dirty_y1; // rows that may be dirty, y0 > y1 when the frame is clean
+    int headless;           // no SDL at all, frames only go to the capture file
+    FILE *capture;
+    uint64_t flushes;
+    uint64_t flushes_clean; // nothing changed since the flush before
+    uint64_t pixels_uploaded;
+    uint64_t frames;        // captured
+    uint64_t key_frames;
+    uint64_t capture_bytes;
 }lcd_t;
 
-device_t *lcd_create(const char *name, int width, int height);
+device_t *lcd_create(const char *name, int width, int height, int format, int headless);
+int lcd_set_capture(device_t *device, const char *path);
+void lcd_report(device_t *device, FILE *file);
 int lcd_read(device_t *device, riscv_word_t addr, uint8_t *data, int size);
 int lcd_write(device_t *device, riscv_word_t addr, uint8_t *data, int size);
 
+// rgb565 to argb8888 of n pixels, the lcd picks the best one the host runs
+void lcd_rgb565_to_argb_c(uint32_t *dst, const uint16_t *src, int n);
+#if defined(__SSE2__)
+void lcd_rgb565_to_argb_sse2(uint32_t *dst, const uint16_t *src, int n);
+void lcd_rgb565_to_argb_avx2(uint32_t *dst, const uint16_t *src, int n);
+#endif
+
 #endif 
\ No newline at end of file
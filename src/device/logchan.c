@@ -0,0 +1,244 @@
+#include "device/logchan.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "core/riscv.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+static const char *logchan_drain_names[LOGCHAN_DRAIN_NUM] = {"doorbell", "half", "timer", "exit"};
+
+static logchan_t *logchan_list;
+
+static void logchan_drain_all(void) {
+    for (logchan_t *logchan = logchan_list; logchan; logchan = logchan->next) {
+        logchan_drain(&logchan->device, LOGCHAN_DRAIN_EXIT);
+    }
+}
+
+device_t *logchan_create(const char *name, riscv_word_t base) {
+    logchan_t *logchan = calloc(1, sizeof(logchan_t));
+    device_init(&logchan->device, name, 0, base, sizeof(logchan_reg_t));
+    logchan->device.read = logchan_read;
+    logchan->device.write = logchan_write;
+
+    // what the guest logged last must not be lost however the emulator exits
+    if (!logchan_list) {
+        atexit(logchan_drain_all);
+    }
+    logchan->next = logchan_list;
+    logchan_list = logchan;
+    return &logchan->device;
+}
+
+#ifndef _WIN32
+static logchan_shm_t *logchan_shm_open(const char *name) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s%s", name[0] == '/' ? "" : "/", name);
+    int fd = shm_open(path, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    size_t size = sizeof(logchan_shm_t) + LOGCHAN_SHM_SIZE;
+    if (ftruncate(fd, (off_t)size) < 0) {
+        close(fd);
+        return NULL;
+    }
+    logchan_shm_t *shm = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        return NULL;
+    }
+
+    shm->size = LOGCHAN_SHM_SIZE;
+    shm->head = 0;
+    shm->tail = 0;
+    __atomic_store_n(&shm->magic, LOGCHAN_SHM_MAGIC, __ATOMIC_RELEASE); // readers wait for it
+    return shm;
+}
+#endif
+
+// shm:name is a shared memory segment, anything else a file or fifo
+int logchan_set_output(device_t *device, const char *path) {
+    logchan_t *logchan = (logchan_t *)device;
+    if (strncmp(path, "shm:", 4) == 0) {
+#ifndef _WIN32
+        logchan->shm = logchan_shm_open(path + 4);
+#endif
+        if (!logchan->shm) {
+            fprintf(stderr, "open log channel shm %s failed\n", path + 4);
+            return -1;
+        }
+        return 0;
+    }
+
+    logchan->file = fopen(path, "wb");
+    if (!logchan->file) {
+        fprintf(stderr, "open log channel output %s failed\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+// returns how much was taken, less than len only when a shm reader is behind
+static uint32_t logchan_out(logchan_t *logchan, const uint8_t *data, uint32_t len) {
+    if (logchan->file) {
+        return (uint32_t)fwrite(data, 1, len, logchan->file);
+    }
+    if (!logchan->shm) {
+        return len; // no output, the ring is still drained so the guest never waits
+    }
+
+    logchan_shm_t *shm = logchan->shm;
+    uint32_t head = shm->head;
+    uint32_t space = shm->size - (head - __atomic_load_n(&shm->tail, __ATOMIC_ACQUIRE));
+    if (len > space) {
+        len = space;
+    }
+    uint32_t offset = head & (shm->size - 1);
+    uint32_t first = shm->size - offset < len ? shm->size - offset : len;
+    memcpy(shm->data + offset, data, first);
+    memcpy(shm->data, data + first, len - first);
+    __atomic_store_n(&shm->head, head + len, __ATOMIC_RELEASE);
+    return len;
+}
+
+static void logchan_timer(void *arg, uint64_t cycle) {
+    logchan_drain((device_t *)arg, LOGCHAN_DRAIN_TIMER);
+}
+
+// everything between tail and head goes out in at most two writes, one per side of the wrap
+void logchan_drain(device_t *device, int reason) {
+    logchan_t *logchan = (logchan_t *)device;
+    logchan_reg_t *regs = &logchan->regs;
+    uint32_t used = regs->head - regs->tail;
+    if (!(regs->ctrl & LOGCHAN_CTRL_EN) || !used) {
+        return;
+    }
+
+    uint8_t *ring = riscv_mem_host(device->riscv, regs->ring, regs->size); // the whole ring in one memory
+    if (!ring) {
+        fprintf(stderr, "log channel ring %08x size %x is not in memory, disabled\n", regs->ring, regs->size);
+        regs->ctrl &= ~LOGCHAN_CTRL_EN;
+        return;
+    }
+    if (used > regs->size) {
+        fprintf(stderr, "log channel head ran %u bytes past the tail, oldest dropped\n", used - regs->size);
+        regs->tail = regs->head - regs->size;
+        used = regs->size;
+    }
+
+    while (used) {
+        uint32_t offset = regs->tail & (regs->size - 1);
+        uint32_t len = regs->size - offset < used ? regs->size - offset : used;
+        uint32_t n = logchan_out(logchan, ring + offset, len);
+        regs->tail += n;
+        used -= n;
+        logchan->bytes += n;
+        if (n < len) {
+            logchan->stalls++;
+            break;
+        }
+    }
+    if (logchan->file) {
+        fflush(logchan->file);
+    }
+    logchan->writes++;
+    logchan->drains[reason]++;
+
+    // a stalled shm reader is retried on the timer, the guest sees the ring stay full meanwhile
+    riscv_t *riscv = device->riscv;
+    if (used && reason != LOGCHAN_DRAIN_EXIT) {
+        vtime_schedule(riscv, vtime_now(riscv) + riscv->vtime.freq / LOGCHAN_DRAIN_HZ, logchan_timer, logchan);
+    } else if (!used) {
+        vtime_cancel(riscv, logchan_timer, logchan);
+    }
+}
+
+// the ring is left to fill, the guest only pays for a store to HEAD per record or batch
+static void logchan_set_head(logchan_t *logchan, uint32_t head) {
+    riscv_t *riscv = logchan->device.riscv;
+    logchan_reg_t *regs = &logchan->regs;
+    int was_empty = regs->head == regs->tail;
+    regs->head = head;
+    if (!(regs->ctrl & LOGCHAN_CTRL_EN)) {
+        return;
+    }
+
+    if (head - regs->tail >= regs->size / 2) {
+        logchan_drain(&logchan->device, LOGCHAN_DRAIN_HALF);
+    } else if (was_empty && head != regs->tail) {
+        vtime_schedule(riscv, vtime_now(riscv) + riscv->vtime.freq / LOGCHAN_DRAIN_HZ, logchan_timer, logchan);
+    }
+}
+
+void logchan_report(device_t *device, FILE *file) {
+    logchan_t *logchan = (logchan_t *)device;
+    riscv_t *riscv = device->riscv;
+    double seconds = (double)vtime_now(riscv) / riscv->vtime.freq;
+
+    fprintf(file, "%s: %llu bytes in %llu writes, %.1f bytes per write, %.0f bytes per guest second, %llu stalls\n",
+            device->name, (unsigned long long)logchan->bytes, (unsigned long long)logchan->writes,
+            logchan->writes ? (double)logchan->bytes / logchan->writes : 0.0,
+            seconds > 0 ? logchan->bytes / seconds : 0.0, (unsigned long long)logchan->stalls);
+    fprintf(file, "  drains:");
+    for (int i = 0; i < LOGCHAN_DRAIN_NUM; i++) {
+        fprintf(file, " %s %llu", logchan_drain_names[i], (unsigned long long)logchan->drains[i]);
+    }
+    fprintf(file, "\n");
+}
+
+int logchan_read(device_t *device, riscv_word_t addr, uint8_t *data, int size) {
+    logchan_t *logchan = (logchan_t *)device;
+    riscv_word_t offset = addr - device->base;
+    if (offset + size > sizeof(logchan_reg_t)) {
+        return -1;
+    }
+
+    memcpy(data, (uint8_t *)&logchan->regs + offset, size);
+    return 0;
+}
+
+int logchan_write(device_t *device, riscv_word_t addr, uint8_t *data, int size) {
+    logchan_t *logchan = (logchan_t *)device;
+    logchan_reg_t *regs = &logchan->regs;
+    riscv_word_t offset = addr - device->base;
+    uint32_t val = 0;
+    memcpy(&val, data, size > 4 ? 4 : size);
+
+    switch (offset) {
+        case LOGCHAN_CTRL_OFF:
+            if ((val & LOGCHAN_CTRL_EN) && !(regs->ctrl & LOGCHAN_CTRL_EN)) {
+                if (!regs->size || (regs->size & (regs->size - 1))) {
+                    fprintf(stderr, "log channel size %x is not a power of two\n", regs->size);
+                    return 0;
+                }
+                regs->head = 0;
+                regs->tail = 0;
+            } else if (!(val & LOGCHAN_CTRL_EN)) {
+                logchan_drain(device, LOGCHAN_DRAIN_BELL); // nothing is lost by turning it off
+            }
+            regs->ctrl = val;
+            break;
+        case LOGCHAN_RING_OFF:
+            regs->ring = val;
+            break;
+        case LOGCHAN_SIZE_OFF:
+            regs->size = val;
+            break;
+        case LOGCHAN_HEAD_OFF:
+            logchan_set_head(logchan, val);
+            break;
+        case LOGCHAN_BELL_OFF:
+            logchan_drain(device, LOGCHAN_DRAIN_BELL);
+            break;
+        default:
+            return -1;
+    }
+
+    return 0;
+}
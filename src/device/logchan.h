@@ -0,0 +1,72 @@
+#ifndef LOGCHAN_H
+#define LOGCHAN_H
+
+#include "device/device.h"
+#include <stdint.h>
+#include <stdio.h>
+
+// a log ring the guest keeps in its own ram, the host copies it out in bulk
+// the guest writes records at BASE + (HEAD & (SIZE - 1)), then stores the new HEAD
+// the host moves TAIL up to HEAD as it drains, the guest may write while HEAD - TAIL < SIZE
+// HEAD and TAIL run freely and wrap at 2^32
+#define LOGCHAN_BASE        0xA2000000
+
+#define LOGCHAN_CTRL_OFF    0x00
+#define LOGCHAN_RING_OFF    0x04    // guest address of the ring
+#define LOGCHAN_SIZE_OFF    0x08    // ring bytes, a power of two
+#define LOGCHAN_HEAD_OFF    0x0C    // written by the guest
+#define LOGCHAN_TAIL_OFF    0x10    // written by the host, read only for the guest
+#define LOGCHAN_BELL_OFF    0x14    // any write drains now
+
+#define LOGCHAN_CTRL_EN     (1 << 0)
+
+#define LOGCHAN_DRAIN_HZ    100     // a ring with data in it is drained at least this often in guest time
+
+#define LOGCHAN_DRAIN_BELL  0
+#define LOGCHAN_DRAIN_HALF  1       // head moved past half the ring
+#define LOGCHAN_DRAIN_TIMER 2
+#define LOGCHAN_DRAIN_EXIT  3
+#define LOGCHAN_DRAIN_NUM   4
+
+// "shm:name" outputs go to a posix shared memory segment laid out as this header and the data
+// the emulator moves head, the reader moves tail, both run freely like the guest ring
+#define LOGCHAN_SHM_MAGIC   0x4e48434c  // "LCHN"
+#define LOGCHAN_SHM_SIZE    (4 * 1024 * 1024)
+
+typedef struct _logchan_shm_t {
+    uint32_t magic;
+    uint32_t size;
+    uint32_t head;
+    uint32_t tail;
+    uint8_t data[];
+}logchan_shm_t;
+
+typedef struct _logchan_reg_t {
+    uint32_t ctrl;
+    uint32_t ring;
+    uint32_t size;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t bell;
+}logchan_reg_t;
+
+typedef struct _logchan_t {
+    device_t device;
+    logchan_reg_t regs;
+    FILE *file;                         // file or fifo output, NULL if shm is used
+    logchan_shm_t *shm;
+    uint64_t bytes;
+    uint64_t writes;
+    uint64_t drains[LOGCHAN_DRAIN_NUM];
+    uint64_t stalls;                    // drains cut short by a full shm ring
+    struct _logchan_t *next;            // every log channel, drained at exit
+}logchan_t;
+
+device_t *logchan_create(const char *name, riscv_word_t base);
+int logchan_set_output(device_t *device, const char *path);
+void logchan_drain(device_t *device, int reason);
+void logchan_report(device_t *device, FILE *file);
+int logchan_read(device_t *device, riscv_word_t addr, uint8_t *data, int size);
+int logchan_write(device_t *device, riscv_word_t addr, uint8_t *data, int size);
+
+#endif
@@ -1,8 +1,57 @@
+#ifdef __linux__
+#define _GNU_SOURCE // memfd_create
+#endif
 #include "device/mem.h"
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// only address space is reserved, the os commits zero filled pages on first touch
+// anonymous mappings are also page aligned, so the loader can map file pages over them
+// huge pages are tried as MAP_HUGETLB first, then as a madvise hint
+static uint8_t *mem_alloc(riscv_word_t size, riscv_word_t attr, int *backing) {
+    *backing = MEM_BACKING_SMALL;
+#ifndef _WIN32
+    void *mem;
+#ifdef MAP_HUGETLB
+    if (attr & MEM_ATTR_HUGEPAGE) {
+        size_t huge_size = ((size_t)size + MEM_HUGEPAGE_SIZE - 1) & ~(size_t)(MEM_HUGEPAGE_SIZE - 1);
+        mem = mmap(NULL, huge_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0); // reserved, fails now rather than on touch
+        if (mem != MAP_FAILED) {
+            *backing = MEM_BACKING_HUGETLB;
+            return mem;
+        }
+    }
+#endif
+
+    mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED) {
+        return (uint8_t *)0;
+    }
+#ifdef MADV_HUGEPAGE
+    if ((attr & MEM_ATTR_HUGEPAGE) && madvise(mem, size, MADV_HUGEPAGE) == 0) {
+        *backing = MEM_BACKING_THP;
+    }
+#endif
+    return mem;
+#else
+    return calloc(1, size);
+#endif
+}
+
+riscv_word_t mem_page_size(void) {
+#ifndef _WIN32
+    return (riscv_word_t)sysconf(_SC_PAGESIZE);
+#else
+    return 4096;
+#endif
+}
 
 mem_t *mem_create(const char *name, riscv_word_t attr, riscv_word_t base, riscv_word_t size) {
     mem_t *mem = calloc(1, sizeof(mem_t));
@@ -11,9 +60,11 @@ mem_t *mem_create(const char *name, riscv_word_t attr, riscv_word_t base, riscv_
         return mem;
     }
 
-    mem->mem = malloc(size);
+    mem->shared_fd = -1;
+    mem->mem = mem_alloc(size, attr, &mem->backing);
     if (mem->mem == NULL) {
         fprintf(stderr, "memory alloc failed\n");
+        free(mem);
         return NULL;
     }
 
@@ -21,6 +72,19 @@ mem_t *mem_create(const char *name, riscv_word_t attr, riscv_word_t base, riscv_
     device_init(device, name, attr, base, size);
     device->read = mem_read;
     device->write = mem_write;
+    device->mem = mem->mem;
+
+    // the typed paths skip the attr check, so they only exist where it would pass
+    if (attr & MEM_ATTR_READABLE) {
+        device->read8 = mem_read8;
+        device->read16 = mem_read16;
+        device->read32 = mem_read32;
+    }
+    if (attr & MEM_ATTR_WRITABLE) {
+        device->write8 = mem_write8;
+        device->write16 = mem_write16;
+        device->write32 = mem_write32;
+    }
 
     return mem;
 }
@@ -69,4 +133,179 @@ int mem_write(device_t *device, riscv_word_t addr, uint8_t *data, int size) {
     }
 
     return 0;
+}
+
+uint8_t mem_read8(device_t *device, riscv_word_t addr) {
+    mem_t *mem = (mem_t*)device;
+    return mem->mem[addr - device->base];
+}
+
+uint16_t mem_read16(device_t *device, riscv_word_t addr) {
+    mem_t *mem = (mem_t*)device;
+    uint16_t val;
+    memcpy(&val, mem->mem + (addr - device->base), 2);
+    return val;
+}
+
+uint32_t mem_read32(device_t *device, riscv_word_t addr) {
+    mem_t *mem = (mem_t*)device;
+    uint32_t val;
+    memcpy(&val, mem->mem + (addr - device->base), 4);
+    return val;
+}
+
+void mem_write8(device_t *device, riscv_word_t addr, uint8_t val) {
+    mem_t *mem = (mem_t*)device;
+    mem->mem[addr - device->base] = val;
+}
+
+void mem_write16(device_t *device, riscv_word_t addr, uint16_t val) {
+    mem_t *mem = (mem_t*)device;
+    memcpy(mem->mem + (addr - device->base), &val, 2);
+}
+
+void mem_write32(device_t *device, riscv_word_t addr, uint32_t val) {
+    mem_t *mem = (mem_t*)device;
+    memcpy(mem->mem + (addr - device->base), &val, 4);
+}
+
+// map file pages over [addr, addr + size), private so guest stores never reach the file
+// everything has to be host page aligned, otherwise the caller copies instead
+int mem_map_file(mem_t *mem, riscv_word_t addr, int fd, uint64_t offset, riscv_word_t size) {
+#ifndef _WIN32
+    device_t *device = &mem->device;
+    riscv_word_t page = mem_page_size();
+    if (addr < device->base || addr >= device->end || size > device->end - addr) {
+        return -1;
+    }
+
+    uint8_t *host = mem->mem + (addr - device->base);
+    if (mem->backing == MEM_BACKING_HUGETLB || mem->shared_fd >= 0 || (((uintptr_t)host | offset | size) & (page - 1))) {
+        return -1; // hugetlb and aliased mappings can not be replaced piecewise
+    }
+
+    if (mmap(host, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, (off_t)offset) == MAP_FAILED) {
+        return -1;
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+// whole pages get fresh anonymous ones which the os zero fills when touched
+void mem_zero(mem_t *mem, riscv_word_t addr, riscv_word_t size) {
+    device_t *device = &mem->device;
+    if (addr < device->base || addr >= device->end || size > device->end - addr) {
+        return;
+    }
+
+    uint8_t *start = mem->mem + (addr - device->base);
+    uint8_t *end = start + size;
+#ifndef _WIN32
+    uintptr_t page = mem_page_size();
+    uint8_t *first = (uint8_t *)(((uintptr_t)start + page - 1) & ~(page - 1));
+    uint8_t *last = (uint8_t *)((uintptr_t)end & ~(page - 1));
+    if (first < last && mem->backing != MEM_BACKING_HUGETLB && mem->shared_fd < 0 && mmap(first, last - first, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) != MAP_FAILED) {
+        memset(start, 0, first - start);
+        memset(last, 0, end - last);
+        return;
+    }
+#endif
+    memset(start, 0, size);
+}
+
+// bytes of the region backed by host memory right now
+uint64_t mem_resident(mem_t *mem) {
+    device_t *device = &mem->device;
+    uint64_t size = device->end - device->base;
+#ifndef _WIN32
+    riscv_word_t page = mem_page_size();
+    uint64_t page_num = (size + page - 1) / page;
+    unsigned char *vec = malloc(page_num);
+    if (!vec || mincore(mem->mem, size, vec) < 0) {
+        free(vec);
+        return size;
+    }
+
+    uint64_t resident = 0;
+    for (uint64_t i = 0; i < page_num; i++) {
+        resident += vec[i] & 1;
+    }
+    free(vec);
+    return resident * page;
+#else
+    return size;
+#endif
+}
+
+const char *mem_backing_name(mem_t *mem) {
+    switch (mem->backing) {
+    case MEM_BACKING_THP:
+        return "transparent huge pages";
+    case MEM_BACKING_HUGETLB:
+        return "hugetlb pages";
+    default:
+        return "small pages";
+    }
+}
+
+void mem_report(mem_t *mem, FILE *file) {
+    device_t *device = &mem->device;
+    fprintf(file, "%s: %llu KB resident of %llu KB reserved, %s\n", device->name,
+            (unsigned long long)(mem_resident(mem) >> 10),
+            (unsigned long long)((device->end - device->base) >> 10), mem_backing_name(mem));
+}
+
+// move the region onto a memfd and map it a second time at alias, both views share pages
+// mem keeps its address so the page table and the jit stay valid
+int mem_alias(mem_t *mem, uint8_t *alias, int readable, int writable) {
+#ifdef __linux__
+    device_t *device = &mem->device;
+    riscv_word_t size = device->end - device->base;
+    riscv_word_t page = mem_page_size();
+    if (mem->backing == MEM_BACKING_HUGETLB || mem->shared_fd >= 0 || ((device->base | size) & (page - 1))) {
+        return -1;
+    }
+
+    int fd = memfd_create(device->name, 0);
+    if (fd < 0 || ftruncate(fd, size) < 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    // only pages touched so far carry data
+    unsigned char *vec = malloc(size / page);
+    if (!vec) {
+        close(fd);
+        return -1;
+    }
+    if (mincore(mem->mem, size, vec) < 0) {
+        memset(vec, 1, size / page);
+    }
+    for (riscv_word_t i = 0; i < size / page; i++) {
+        if ((vec[i] & 1) && pwrite(fd, mem->mem + (size_t)i * page, page, (off_t)i * page) != page) {
+            free(vec);
+            close(fd);
+            return -1;
+        }
+    }
+    free(vec);
+
+    int prot = (readable ? PROT_READ : 0) | (writable ? PROT_WRITE : 0);
+    if (mmap(mem->mem, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+        mmap(alias, size, prot ? prot : PROT_NONE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        fprintf(stderr, "alias %s failed\n", device->name);
+        exit(-1); // mem may be half replaced
+    }
+
+    mem->shared_fd = fd;
+    mem->backing = MEM_BACKING_SMALL;
+    return 0;
+#else
+    return -1;
+#endif
 }
\ No newline at end of file
@@ -1,20 +1,45 @@
 #ifndef MEM_H
 #define MEM_H
 
+#include <stdio.h>
 #include "core/types.h"
 #include "device/device.h"
 
 #define MEM_ATTR_READABLE     (1 << 0)
 #define MEM_ATTR_WRITABLE     (1 << 1)
+#define MEM_ATTR_HUGEPAGE     (1 << 2) // prefer 2MB host pages
+#define MEM_ATTR_DEVICE       (1 << 3) // backs a device buffer, never taken as ram
+
+#define MEM_HUGEPAGE_SIZE     (2 * 1024 * 1024)
+
+// host memory behind the region
+#define MEM_BACKING_SMALL     0 // normal host pages
+#define MEM_BACKING_THP       1 // transparent huge pages requested with madvise
+#define MEM_BACKING_HUGETLB   2 // reserved huge pages, MAP_HUGETLB
 
 typedef struct _mem_t {
     device_t device;
     uint8_t *mem;
+    int backing;
+    int shared_fd;  // memfd behind mem once it is aliased, -1 before
 }mem_t;
 
 mem_t *mem_create(const char *name, riscv_word_t attr, riscv_word_t base, riscv_word_t size);
+riscv_word_t mem_page_size(void);
+int mem_map_file(mem_t *mem, riscv_word_t addr, int fd, uint64_t offset, riscv_word_t size);
+void mem_zero(mem_t *mem, riscv_word_t addr, riscv_word_t size);
+uint64_t mem_resident(mem_t *mem);
+void mem_report(mem_t *mem, FILE *file);
+const char *mem_backing_name(mem_t *mem);
+int mem_alias(mem_t *mem, uint8_t *alias, int readable, int writable);
 int mem_read(device_t *device, riscv_word_t addr, uint8_t *data, int size);
 int mem_write(device_t *device, riscv_word_t addr, uint8_t *data, int size);
+uint8_t mem_read8(device_t *device, riscv_word_t addr);
+uint16_t mem_read16(device_t *device, riscv_word_t addr);
+uint32_t mem_read32(device_t *device, riscv_word_t addr);
+void mem_write8(device_t *device, riscv_word_t addr, uint8_t val);
+void mem_write16(device_t *device, riscv_word_t addr, uint16_t val);
+void mem_write32(device_t *device, riscv_word_t addr, uint32_t val);
 
 
 #endif
\ No newline at end of file
@@ -1,7 +1,16 @@
 #include "device/pfic.h"
+#include "core/riscv.h"
 #include "stdlib.h"
 #include <string.h>
 
+// the cpu only scans the pending irqs after this was raised
+// raised after the registers changed so the scan sees the new state
+static inline void pfic_raise_irq_check(pfic_t *pfic) {
+    if (pfic->device.riscv) {
+        pfic->device.riscv->irq_check = 1;
+    }
+}
+
 device_t *pfic_create(const char *name, riscv_word_t base) {
     pfic_t *pfic = calloc(1, sizeof(pfic_t));
     device_init(&pfic->device, "pfic", 0, PFIC_BASE, sizeof(pfic_reg_t));
@@ -56,10 +65,13 @@ int pfic_write(device_t *device, riscv_word_t addr, uint8_t *data, int size) {
         return -1;
     }
 
+    pfic_raise_irq_check(pfic);
     return 0;
 }
 
-int pfic_get_irq_pending(pfic_t *pfic) {
+// highest priority irq both enabled and pending other than exclude, -1 if none
+// the one being handled is excluded so it does not hide those behind it
+int pfic_get_irq_pending(pfic_t *pfic, int exclude) {
     int res_idx = -1;
     int res_prior = -1;
 
@@ -76,7 +88,10 @@ int pfic_get_irq_pending(pfic_t *pfic) {
             }
 
             // both enabled and pending
-            int curr_idx = i*8 + j;
+            int curr_idx = i*32 + j;
+            if (curr_idx == exclude) {
+                continue;
+            }
             int curr_prior = pfic->regs.IPRIOR[curr_idx];
             
             if (res_idx == -1) {
@@ -104,4 +119,5 @@ void pfic_set_irq_pending(pfic_t *pfic, int irq) {
     int reg_num = irq / 32;
     int in_reg_num = irq % 32;
     pfic->regs.IPR[reg_num] |= (1 << in_reg_num);
+    pfic_raise_irq_check(pfic);
 }
\ No newline at end of file
@@ -47,7 +47,7 @@ int pfic_read(device_t *device, riscv_word_t addr, uint8_t *data, int size);
 int pfic_write(device_t *device, riscv_word_t addr, uint8_t *data, int size);
 device_t *pfic_create(const char *name, riscv_word_t base);
 
-int pfic_get_irq_pending(pfic_t *pfic);
+int pfic_get_irq_pending(pfic_t *pfic, int exclude);
 void pfic_clear_irq_pending(pfic_t *pfic, int irq);
 void pfic_set_irq_pending(pfic_t *pfic, int irq);
 
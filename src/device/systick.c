@@ -1,30 +1,82 @@
 #include "device/systick.h"
 #include "device/pfic.h"
 #include "core/riscv.h"
-#include "plat/plat.h"
+#include <stdlib.h>
+#include <string.h>
 
-static void systick_thread(void *arg) {
+// CNT is not stepped, it is worked out from the core cycles since cycle_base
+static int systick_shift(systick_t *systick) {
+    return (systick->regs.CTLR & SYSTICK_CTLR_STCLK) ? 0 : 3;
+}
+
+static void systick_sync(systick_t *systick) {
+    if (!(systick->regs.CTLR & SYSTICK_CTLR_STE)) {
+        return;
+    }
+
+    int shift = systick_shift(systick);
+    uint64_t ticks = (vtime_now(systick->device.riscv) - systick->cycle_base) >> shift;
+    if (systick->regs.CTLR & SYSTICK_CTLR_MODE) {
+        systick->regs.CNT -= ticks;
+    } else {
+        systick->regs.CNT += ticks;
+    }
+    systick->cycle_base += ticks << shift; // keeps the part of a tick already elapsed
+}
+
+static void systick_expire(void *arg, uint64_t cycle);
+
+// the next compare match, up counting matches at CMP and down counting at 0
+static void systick_schedule(systick_t *systick) {
+    riscv_t *riscv = systick->device.riscv;
+    if (!(systick->regs.CTLR & SYSTICK_CTLR_STE)) {
+        vtime_cancel(riscv, systick_expire, systick);
+        return;
+    }
+
+    uint64_t ticks = 0;
+    if (systick->regs.CTLR & SYSTICK_CTLR_MODE) {
+        ticks = systick->regs.CNT;
+    } else if (systick->regs.CMP > systick->regs.CNT) {
+        ticks = systick->regs.CMP - systick->regs.CNT;
+    }
+
+    if (ticks == 0) {
+        vtime_cancel(riscv, systick_expire, systick);
+        return;
+    }
+    vtime_schedule(riscv, systick->cycle_base + (ticks << systick_shift(systick)), systick_expire, systick);
+}
+
+static void systick_expire(void *arg, uint64_t cycle) {
     systick_t *systick = (systick_t *)arg;
-    while (1) {
-        if ((systick->regs.CTLR & (1 << 0)) == 0) { // start systick
-            continue;
-        }
-
-        thread_msleep((int)(systick->regs.CMP / (SYSTICK_FREQ / 1000)));
-        
-        systick->regs.SR |= 1;
-        if (systick->regs.CTLR & (1 << 1)) {
-            pfic_set_irq_pending(systick->device.riscv->pfic, IRQ_SYSTICK);
-        }
+    int down = systick->regs.CTLR & SYSTICK_CTLR_MODE;
+    systick->regs.CNT = down ? 0 : systick->regs.CMP;
+    systick->cycle_base = cycle;
+
+    systick->regs.SR |= 1;
+    if (systick->regs.CTLR & SYSTICK_CTLR_STIE) {
+        pfic_set_irq_pending(systick->device.riscv->pfic, IRQ_SYSTICK);
+    }
+
+    // without reload it keeps counting and does not match again
+    if (systick->regs.CTLR & SYSTICK_CTLR_STRE) {
+        systick->regs.CNT = down ? systick->regs.CMP : 0;
+        systick_schedule(systick);
     }
 }
 
+// CNT moves with the clock, SR and the rest only change on a compare event or a write
+static int systick_timed(device_t *device, riscv_word_t addr) {
+    return addr == SYSTICK_CNT || addr == SYSTICK_CNT + 4;
+}
+
 device_t *systick_create(const char * name, riscv_word_t base) {
     systick_t *systick = calloc(1, sizeof(systick_t));
     device_init(&systick->device, "systick", 0, base, sizeof(systick_reg_t));
     systick->device.read = systick_read;
     systick->device.write = systick_write;
-    thread_create(systick_thread, systick);
+    systick->device.timed = systick_timed;
     return &systick->device;
 }
 
@@ -38,16 +90,18 @@ int systick_read(device_t *device, riscv_word_t addr, uint8_t *data, int size) {
             memcpy(data, &systick->regs.SR, size);
             break;
         case SYSTICK_CNT:
+            systick_sync(systick);
             memcpy(data, &systick->regs.CNT, size);
             break;
         case SYSTICK_CNT + 4: // since the reg is 64 bits long, it needs to read twice
-            memcpy(data, &systick->regs.CNT + 1, size);
+            systick_sync(systick);
+            memcpy(data, (uint8_t *)&systick->regs.CNT + 4, size);
             break;
         case SYSTICK_CMP:
             memcpy(data, &systick->regs.CMP, size);
             break;
         case SYSTICK_CMP + 4: // since the reg is 64 bits long, it needs to read twice
-            memcpy(data, &systick->regs.CMP + 1, size);
+            memcpy(data, (uint8_t *)&systick->regs.CMP + 4, size);
             break;
         default:
             return -1;
@@ -59,27 +113,29 @@ int systick_read(device_t *device, riscv_word_t addr, uint8_t *data, int size) {
 
 int systick_write(device_t *device, riscv_word_t addr, uint8_t *data, int size) {
     systick_t *systick = (systick_t*)device;
+    riscv_word_t val = 0;
+
+    // bring CNT up to date under the old settings before any of them change
+    int running = systick->regs.CTLR & SYSTICK_CTLR_STE;
+    systick_sync(systick);
     switch (addr) {
         case SYSTICK_SR: // initial value is 0, set to 1 after interrupt triggers
-            riscv_word_t val = 0;
             memcpy(&val, data, size);
             if ((val & 0x1) == 0) {
                 systick->regs.SR = 0;
             }
-            break;
+            return 0;
         case SYSTICK_CTLR:
-            val = 0;
             memcpy(&val, data, size);
             systick->regs.CTLR = val;
 
-            // CNT reg is set but is actually not used
-            if (val & (1 << 4) && val & (1 << 5)) { // from high to low
+            if ((val & SYSTICK_CTLR_MODE) && (val & SYSTICK_CTLR_INIT)) { // from high to low
                 systick->regs.CNT = systick->regs.CMP;
-            } else if (~(val & (1 << 4)) && val & (1 << 5)) { // from low to high
+            } else if (val & SYSTICK_CTLR_INIT) { // from low to high
                 systick->regs.CNT = 0;
             }
             // triggers SWI interrupt
-            if (val & (1 << 31)) {
+            if (val & SYSTICK_CTLR_SWIE) {
                 pfic_set_irq_pending(systick->device.riscv->pfic, IRQ_SWI);
             }
             break;
@@ -87,18 +143,23 @@ int systick_write(device_t *device, riscv_word_t addr, uint8_t *data, int size)
             memcpy(&systick->regs.CNT, data, size);
             break;
         case SYSTICK_CNT + 4: // since the reg is 64 bits long, it needs to read twice
-            memcpy(&systick->regs.CNT + 1, data, size);
+            memcpy((uint8_t *)&systick->regs.CNT + 4, data, size);
             break;
         case SYSTICK_CMP:
             memcpy(&systick->regs.CMP, data, size);
             break;
         case SYSTICK_CMP + 4: // since the reg is 64 bits long, it needs to read twice
-            memcpy(&systick->regs.CMP + 1, data , size);
+            memcpy((uint8_t *)&systick->regs.CMP + 4, data , size);
             break;
         default:
             return -1;
             break;
     }
 
+    // a fresh start or a new clock source counts from now, the match is worked out again
+    if (!running || addr == SYSTICK_CTLR) {
+        systick->cycle_base = vtime_now(systick->device.riscv);
+    }
+    systick_schedule(systick);
     return 0;
-}
\ No newline at end of file
+}
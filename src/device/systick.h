@@ -12,6 +12,14 @@
 #define SYSTICK_CNT     0xE000F008
 #define SYSTICK_CMP     0xE000F010
 
+#define SYSTICK_CTLR_STE    (1 << 0)    // counter enable
+#define SYSTICK_CTLR_STIE   (1 << 1)    // irq on compare match
+#define SYSTICK_CTLR_STCLK  (1 << 2)    // counts at the core clock, else at a eighth of it
+#define SYSTICK_CTLR_STRE   (1 << 3)    // reload on compare match
+#define SYSTICK_CTLR_MODE   (1 << 4)    // counts down
+#define SYSTICK_CTLR_INIT   (1 << 5)    // loads the initial count
+#define SYSTICK_CTLR_SWIE   (1u << 31)  // software irq
+
 typedef struct _systick_reg_t {
     uint32_t CTLR;
     uint32_t SR;
@@ -22,6 +30,7 @@ typedef struct _systick_reg_t {
 typedef struct _systick_t {
     device_t device;
     systick_reg_t regs;
+    uint64_t cycle_base;    // core cycle at which regs.CNT was last brought up to date
 }systick_t;
 
 device_t *systick_create(const char * name, riscv_word_t base);
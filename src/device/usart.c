@@ -2,7 +2,106 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "device/mem.h"
+#include "core/riscv.h"
+#include "device/pfic.h"
+#include "plat/plat.h"
 #include <string.h>
+#include <errno.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+static const char *usart_flush_names[USART_FLUSH_NUM] = {"newline", "full", "timer", "exit"};
+
+static usart_t *usart_list;
+
+static void usart_flush_all(void) {
+    for (usart_t *usart = usart_list; usart; usart = usart->next) {
+        usart_flush(&usart->device, USART_FLUSH_EXIT);
+    }
+}
+
+// BRR holds fck / baud, a frame is a start bit, 8 data bits and a stop bit
+static uint64_t usart_frame_cycles(usart_t *usart) {
+    return 10 * (uint64_t)usart->regs.brr;
+}
+
+static uint32_t usart_rx_pending(usart_t *usart) {
+    return __atomic_load_n(&usart->rx_head, __ATOMIC_ACQUIRE) - usart->rx_tail;
+}
+
+// moves the next byte into DATAR once the guest has taken the last one
+// bytes wait in the ring instead of overrunning, the host side has no baud rate to keep
+static void usart_rx_event(void *arg, uint64_t cycle) {
+    usart_t *usart = (usart_t *)arg;
+    uint16_t on = USART_CTRL1_UE | USART_CTRL1_RE;
+    if ((usart->regs.ctrl1 & on) != on || (usart->regs.statr & USART_STATR_RXNE) || !usart_rx_pending(usart)) {
+        return;
+    }
+
+    usart->regs.datar = usart->rx_buf[usart->rx_tail & (USART_RX_BUF_SIZE - 1)];
+    __atomic_store_n(&usart->rx_tail, usart->rx_tail + 1, __ATOMIC_RELEASE);
+    usart->regs.statr |= USART_STATR_RXNE;
+    usart->rx_bytes++;
+    if (usart->regs.ctrl1 & USART_CTRL1_RXNEIE) {
+        pfic_set_irq_pending(usart->device.riscv->pfic, USART1_IRQ);
+        usart->rx_irqs++;
+    }
+}
+
+static void usart_rx_schedule(usart_t *usart, uint64_t cycle) {
+    vtime_schedule(usart->device.riscv, cycle, usart_rx_event, usart);
+}
+
+// the reader thread has put bytes in the ring
+static void usart_rx_kick(void *arg, uint64_t cycle) {
+    usart_t *usart = (usart_t *)arg;
+    if (!(usart->regs.statr & USART_STATR_RXNE)) {
+        usart_rx_schedule(usart, cycle);
+    }
+}
+
+static void usart_attach(device_t *device) {
+    vtime_on_kick(device->riscv, usart_rx_kick, device);
+}
+
+// host side, it may block in read as long as it likes, the cpu thread never waits on it
+static void usart_rx_thread(void *arg) {
+    usart_t *usart = (usart_t *)arg;
+    while (1) {
+        uint32_t head = usart->rx_head;
+        uint32_t space = USART_RX_BUF_SIZE - (head - __atomic_load_n(&usart->rx_tail, __ATOMIC_ACQUIRE));
+        if (space == 0) {
+            thread_msleep(1); // the guest is behind, wait for it to drain
+            continue;
+        }
+
+        uint32_t offset = head & (USART_RX_BUF_SIZE - 1);
+        uint32_t len = USART_RX_BUF_SIZE - offset; // up to the wrap, the rest on the next read
+        if (len > space) {
+            len = space;
+        }
+        if (len > USART_RX_READ_SIZE) {
+            len = USART_RX_READ_SIZE;
+        }
+
+        int n = (int)read(usart->rx_fd, usart->rx_buf + offset, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break; // eof or the peer went away, what is in the ring is still delivered
+        }
+
+        __atomic_store_n(&usart->rx_head, head + n, __ATOMIC_RELEASE);
+        vtime_kick(usart->device.riscv);
+    }
+}
 
 device_t *usart_create(const char *name, riscv_word_t base) {
     usart_t *usart = calloc(1, sizeof(usart_t));
@@ -12,20 +111,148 @@ device_t *usart_create(const char *name, riscv_word_t base) {
     device_init(&usart->device, name, 0, base, sizeof(usart_reg_t));
     usart->device.read = usart_read;
     usart->device.write = usart_write;
+    usart->device.attach = usart_attach;
+    usart->tx_file = stdout;
+    usart->tx_line = isatty(fileno(stdout));
+    usart->rx_fd = -1;
 
+    // buffered tx must not be lost however the emulator exits
+    if (!usart_list) {
+        atexit(usart_flush_all);
+    }
+    usart->next = usart_list;
+    usart_list = usart;
     return &usart->device;
 }
 
+// a regular file is truncated, a fifo blocks here until it has a reader
+int usart_set_output(device_t *device, const char *path) {
+    usart_t *usart = (usart_t *)device;
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "open usart output %s failed\n", path);
+        return -1;
+    }
+
+    usart_flush(device, USART_FLUSH_EXIT);
+    if (usart->tx_file != stdout) {
+        fclose(usart->tx_file);
+    }
+    usart->tx_file = file;
+    usart->tx_line = isatty(fileno(file));
+    return 0;
+}
+
+// - is stdin, a unix socket is connected to, anything else (fifo, pty, file) is opened for reading
+int usart_set_input(device_t *device, const char *path) {
+    usart_t *usart = (usart_t *)device;
+    int fd = -1;
+    if (strcmp(path, "-") == 0) {
+        fd = 0;
+    } else {
+#ifndef _WIN32
+        struct stat st;
+        if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+            struct sockaddr_un addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+            fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+                close(fd);
+                fd = -1;
+            }
+        } else {
+            fd = open(path, O_RDONLY | O_NOCTTY);
+        }
+#endif
+    }
+
+    if (fd < 0) {
+        fprintf(stderr, "open usart input %s failed\n", path);
+        return -1;
+    }
+
+    usart->rx_fd = fd;
+    thread_create(usart_rx_thread, usart);
+    return 0;
+}
+
+// whatever is buffered goes out in a single write
+void usart_flush(device_t *device, int reason) {
+    usart_t *usart = (usart_t *)device;
+    if (!usart->tx_len) {
+        return;
+    }
+
+    fwrite(usart->tx_buf, 1, usart->tx_len, usart->tx_file);
+    fflush(usart->tx_file);
+    usart->tx_writes++;
+    usart->tx_flushes[reason]++;
+    usart->tx_len = 0;
+}
+
+static void usart_flush_timer(void *arg, uint64_t cycle) {
+    usart_flush((device_t *)arg, USART_FLUSH_TIMER);
+}
+
+// lines go out as they end on a terminal, anything else waits for the buffer or the timer
+static void usart_tx(usart_t *usart, uint8_t ch) {
+    riscv_t *riscv = usart->device.riscv;
+    if (!usart->tx_len) {
+        vtime_schedule(riscv, vtime_now(riscv) + riscv->vtime.freq / USART_TX_FLUSH_HZ, usart_flush_timer, usart);
+    }
+
+    usart->tx_buf[usart->tx_len++] = ch;
+    usart->tx_bytes++;
+    if (usart->tx_len == USART_TX_BUF_SIZE) {
+        usart_flush(&usart->device, USART_FLUSH_FULL);
+    } else if (ch == '\n' && usart->tx_line) {
+        usart_flush(&usart->device, USART_FLUSH_NEWLINE);
+    }
+}
+
+void usart_report(device_t *device, FILE *file) {
+    usart_t *usart = (usart_t *)device;
+    riscv_t *riscv = device->riscv;
+    double seconds = (double)vtime_now(riscv) / riscv->vtime.freq;
+
+    fprintf(file, "%s tx: %llu bytes in %llu writes, %.1f bytes per write, %.0f bytes per guest second\n",
+            device->name, (unsigned long long)usart->tx_bytes, (unsigned long long)usart->tx_writes,
+            usart->tx_writes ? (double)usart->tx_bytes / usart->tx_writes : 0.0,
+            seconds > 0 ? usart->tx_bytes / seconds : 0.0);
+    fprintf(file, "%s rx: %llu bytes, %llu irqs, %u waiting\n", device->name,
+            (unsigned long long)usart->rx_bytes, (unsigned long long)usart->rx_irqs, usart_rx_pending(usart));
+    fprintf(file, "  flushes:");
+    for (int i = 0; i < USART_FLUSH_NUM; i++) {
+        fprintf(file, " %s %llu", usart_flush_names[i], (unsigned long long)usart->tx_flushes[i]);
+    }
+    fprintf(file, "\n");
+}
+
 int usart_read(device_t *device, riscv_word_t addr, uint8_t *data, int size) {
     riscv_word_t offset = addr - device->base;
     usart_t *usart = (usart_t*)device;
 
     switch (offset) {
-        case USART1_STATR_OFF:
+        case USART1_STATR_OFF: {
+            // tx is buffered on the host, the shift register is always free
+            uint16_t statr = usart->regs.statr | USART_STATR_TXE | USART_STATR_TC;
+            memcpy(data, (uint8_t*)&statr, size > 2 ? 2 : size);
             break;
+        }
         case USART1_DATAR_OFF:
+            memcpy(data, (uint8_t*)&usart->regs.datar, size > 2 ? 2 : size);
+            // the next byte arrives a frame after this one was taken
+            if (usart->regs.statr & USART_STATR_RXNE) {
+                usart->regs.statr &= ~USART_STATR_RXNE;
+                if (usart_rx_pending(usart)) {
+                    usart_rx_schedule(usart, vtime_now(device->riscv) + usart_frame_cycles(usart));
+                }
+            }
             break;
         case USART1_BRR_OFF:
+            memcpy(data, (uint8_t*)&usart->regs.brr, size > 2 ? 2 : size);
             break;
         case USART1_CTRL_OFF:
             memcpy(data, (uint8_t*)&usart->regs.ctrl1, size);
@@ -46,15 +273,19 @@ int usart_write(device_t *device, riscv_word_t addr, uint8_t *data, int size) {
         case USART1_STATR_OFF:
             break;
         case USART1_DATAR_OFF:
-            if (usart->regs.ctrl1 & (1 << 13)) {
-                // ((usart_t*)device)->regs.datar = *(riscv_word_t*)data;
-                putc(*data, stdout);
+            if (usart->regs.ctrl1 & USART_CTRL1_UE) {
+                usart_tx(usart, *data);
             }
             break;
         case USART1_BRR_OFF:
+            memcpy((uint8_t*)&usart->regs.brr, data, size > 2 ? 2 : size);
             break;
         case USART1_CTRL_OFF:
             memcpy((uint8_t*)&usart->regs.ctrl1, data, size);
+            // the receiver may just have been turned on with bytes waiting
+            if (!(usart->regs.statr & USART_STATR_RXNE) && usart_rx_pending(usart)) {
+                usart_rx_schedule(usart, vtime_now(device->riscv));
+            }
             break;
         default:
             return -1;
@@ -3,6 +3,7 @@
 
 #include "device/device.h"
 #include <stdint.h>
+#include <stdio.h>
 
 #define USART1_BASE         0x40013800
 #define USART1_STATR_OFF    0
@@ -10,6 +11,28 @@
 #define USART1_BRR_OFF      8 
 #define USART1_CTRL_OFF     12
 
+#define USART1_IRQ          53
+
+#define USART_STATR_RXNE    (1 << 5)
+#define USART_STATR_TC      (1 << 6)
+#define USART_STATR_TXE     (1 << 7)
+#define USART_CTRL1_RE      (1 << 2)
+#define USART_CTRL1_TE      (1 << 3)
+#define USART_CTRL1_RXNEIE  (1 << 5)
+#define USART_CTRL1_UE      (1 << 13)
+
+#define USART_TX_BUF_SIZE   (64 * 1024)
+#define USART_TX_FLUSH_HZ   100 // buffered tx is written out at least this often in guest time
+
+#define USART_RX_BUF_SIZE   (64 * 1024) // power of two
+#define USART_RX_READ_SIZE  4096
+
+#define USART_FLUSH_NEWLINE 0
+#define USART_FLUSH_FULL    1
+#define USART_FLUSH_TIMER   2
+#define USART_FLUSH_EXIT    3
+#define USART_FLUSH_NUM     4
+
 // does not include all of the registers
 // only include regs used in test code
 typedef struct _usart_reg_t {
@@ -25,9 +48,27 @@ typedef struct _usart_reg_t {
 typedef struct _usart_t {
     device_t device; 
     usart_reg_t regs;
+    FILE *tx_file;                      // stdout, or the file, fifo or pty given with -u
+    int tx_line;                        // flush on newline, set when tx_file is a terminal
+    uint8_t tx_buf[USART_TX_BUF_SIZE];
+    uint32_t tx_len;
+    uint64_t tx_bytes;
+    uint64_t tx_writes;
+    uint64_t tx_flushes[USART_FLUSH_NUM];
+    int rx_fd;                          // stdin, a fifo, pty or unix socket given with -U, -1 if none
+    uint8_t rx_buf[USART_RX_BUF_SIZE];  // single producer ring, the reader thread fills it
+    uint32_t rx_head;                   // written by the reader thread only
+    uint32_t rx_tail;                   // written by the cpu thread only
+    uint64_t rx_bytes;
+    uint64_t rx_irqs;
+    struct _usart_t *next;              // every usart, flushed at exit
 }usart_t;
 
 device_t *usart_create(const char *name, riscv_word_t base);
+int usart_set_output(device_t *device, const char *path);
+int usart_set_input(device_t *device, const char *path);
+void usart_flush(device_t *device, int reason);
+void usart_report(device_t *device, FILE *file);
 int usart_read(device_t *device, riscv_word_t addr, uint8_t *data, int size);
 int usart_write(device_t *device, riscv_word_t addr, uint8_t *data, int size);
 
@@ -3,10 +3,15 @@
 #include "core/riscv.h"
 #include "device/mem.h"
 #include "test/instr_test.h"
+#include "test/fuse_test.h"
+#include "test/blit_test.h"
+#include "test/lcd_test.h"
 #include "device/usart.h"
 #include "device/pfic.h"
 #include "device/systick.h"
 #include "device/lcd.h"
+#include "device/logchan.h"
+#include "device/blit.h"
 
 #define RISCV_FLASH_BASE 0
 #define RISCV_FLASH_SIZE (16 * 1024 * 1024)
@@ -22,9 +27,21 @@ static void print_usage(const char *filename) {
                     "-t | unit test\n"
                     "-d | print gdb trace\n"
                     "-g [option] | enable gdb server"
-                    "-r addr:size | set ram range\n"
-                    "-f addr:size | set flash range\n"
-                    "-l | enable lcd\n", filename
+                    "-r addr:size[:huge] | set ram range, huge backs it with 2MB host pages\n"
+                    "-f addr:size[:huge] | set flash range, huge backs it with 2MB host pages\n"
+                    "-l | enable lcd and its 2d blit engine\n"
+                    "-H | enable lcd without a window, for machines with no display\n"
+                    "-F path | write every lcd flush to path, as key and delta frames\n"
+                    "-P format | lcd pixel format, argb8888 (default) or rgb565\n"
+                    "-j | compile hot blocks to native code (x86-64)\n"
+                    "-p | print time, execution tier, fusion and memory profile on exit\n"
+                    "-G | guard page mode, guest loads and stores go straight to a 4GB host window (linux)\n"
+                    "-b | run the load/store benchmark with and without the guard window\n"
+                    "-c hz[:ipc] | guest core clock and instrs per cycle for virtual time, default 100000000:1\n"
+                    "-w | timers follow the host clock instead of retired instrs\n"
+                    "-u path | send usart output to a file, fifo or pty instead of stdout\n"
+                    "-U path | feed usart input from a file, fifo, pty or unix socket, - for stdin\n"
+                    "-L path | add the log channel device, its ring is written to a file, fifo or shm:name\n", filename
     );
 }
 
@@ -47,13 +64,28 @@ int main(int argc, char** argv) {
 
     riscv_t *riscv = riscv_create();
 
-    const char *opts[] = {"-h", "-t", "-g", "-r", "-f", "-d", "-l"};
+    const char *opts[] = {"-h", "-t", "-g", "-r", "-f", "-d", "-l", "-j", "-p", "-G", "-b", "-c", "-w", "-u", "-U", "-L", "-H", "-F", "-P"};
     
     int has_ram = 0;
     int has_flash = 0;
     int is_run_test = 0;
     int is_debug = 0;
     int has_gdb_server = 0;
+    int is_jit = 0;
+    int is_profile = 0;
+    int is_guard = 0;
+    int is_bench = 0;
+    int has_lcd = 0;
+    int is_headless = 0;
+    const char *lcd_capture = NULL;
+    int lcd_format = LCD_FORMAT_ARGB8888;
+    const char *usart_output = NULL;
+    const char *usart_input = NULL;
+    const char *logchan_output = NULL;
+    int vtime_mode = VTIME_VIRTUAL;
+    uint64_t vtime_freq = 0;
+    uint32_t vtime_ipc = 0;
+    mem_t *ram = NULL;
     int gdb_server_port = GDB_SERVER_DEFAULT_PORT;
     const char *elf_file = NULL;
 
@@ -96,7 +128,13 @@ int main(int argc, char** argv) {
                 exit(0);
             }
 
-            mem_t *ram = mem_create("ram", MEM_ATTR_READABLE | MEM_ATTR_WRITABLE, base, size);
+            riscv_word_t attr = MEM_ATTR_READABLE | MEM_ATTR_WRITABLE;
+            token = strtok(NULL, " :");
+            if (token && strcmp(token, "huge") == 0) {
+                attr |= MEM_ATTR_HUGEPAGE;
+            }
+
+            ram = mem_create("ram", attr, base, size);
             riscv_add_device(riscv, &ram->device);
             has_ram = 1;
             i++;
@@ -128,7 +166,13 @@ int main(int argc, char** argv) {
                 exit(0);
             }
 
-            mem_t *flash = mem_create("flash", MEM_ATTR_READABLE | MEM_ATTR_WRITABLE, base, size);
+            riscv_word_t attr = MEM_ATTR_READABLE | MEM_ATTR_WRITABLE;
+            token = strtok(NULL, " :");
+            if (token && strcmp(token, "huge") == 0) {
+                attr |= MEM_ATTR_HUGEPAGE;
+            }
+
+            mem_t *flash = mem_create("flash", attr, base, size);
             riscv_add_device(riscv, &flash->device);
             riscv_set_flash(riscv, flash);
             has_flash = 1;
@@ -148,9 +192,82 @@ int main(int argc, char** argv) {
                 }
                 i++;
             }
+        } else if (strncmp(argv[i], "-j", 2) == 0) {
+            is_jit = 1;
+        } else if (strncmp(argv[i], "-p", 2) == 0) {
+            is_profile = 1;
+        } else if (strncmp(argv[i], "-G", 2) == 0) {
+            is_guard = 1;
+        } else if (strncmp(argv[i], "-b", 2) == 0) {
+            is_bench = 1;
+        } else if (strncmp(argv[i], "-u", 2) == 0) {
+            if (i + 1 >= argc || is_opt(opts, argv[i+1], sizeof(opts)/sizeof(opts[0]))) {
+                fprintf(stderr, "Please specify a usart output\n");
+                exit(0);
+            }
+            usart_output = argv[i+1];
+            i++;
+        } else if (strncmp(argv[i], "-U", 2) == 0) {
+            // - is an option-looking arg but means stdin here
+            if (i + 1 >= argc || (strcmp(argv[i+1], "-") != 0 && is_opt(opts, argv[i+1], sizeof(opts)/sizeof(opts[0])))) {
+                fprintf(stderr, "Please specify a usart input\n");
+                exit(0);
+            }
+            usart_input = argv[i+1];
+            i++;
+        } else if (strncmp(argv[i], "-L", 2) == 0) {
+            if (i + 1 >= argc || is_opt(opts, argv[i+1], sizeof(opts)/sizeof(opts[0]))) {
+                fprintf(stderr, "Please specify a log channel output\n");
+                exit(0);
+            }
+            logchan_output = argv[i+1];
+            i++;
+        } else if (strncmp(argv[i], "-w", 2) == 0) {
+            vtime_mode = VTIME_WALL;
+        } else if (strncmp(argv[i], "-c", 2) == 0) {
+            if (i + 1 >= argc || is_opt(opts, argv[i+1], sizeof(opts)/sizeof(opts[0]))) {
+                fprintf(stderr, "Please specify a core clock\n");
+                exit(0);
+            }
+
+            char *end_ptr;
+            vtime_freq = strtoull(argv[i+1], &end_ptr, 10);
+            if (end_ptr == argv[i+1] || vtime_freq == 0) {
+                fprintf(stderr, "Please specify a core clock\n");
+                exit(0);
+            }
+
+            if (*end_ptr == ':') {
+                char *ipc_str = end_ptr + 1;
+                double ipc = strtod(ipc_str, &end_ptr);
+                if (end_ptr == ipc_str || ipc <= 0) {
+                    fprintf(stderr, "Please specify a valid ipc\n");
+                    exit(0);
+                }
+                vtime_ipc = (uint32_t)(ipc * VTIME_IPC_ONE);
+            }
+            i++;
         } else if (strncmp(argv[i], "-l", 2) == 0) {
-            device_t *lcd = lcd_create("lcd", 800, 600);
-            riscv_add_device(riscv, lcd);
+            has_lcd = 1;
+        } else if (strncmp(argv[i], "-H", 2) == 0) {
+            has_lcd = 1;
+            is_headless = 1;
+        } else if (strncmp(argv[i], "-F", 2) == 0) {
+            if (i + 1 >= argc || is_opt(opts, argv[i+1], sizeof(opts)/sizeof(opts[0]))) {
+                fprintf(stderr, "Please specify a lcd capture file\n");
+                exit(0);
+            }
+            has_lcd = 1;
+            lcd_capture = argv[i+1];
+            i++;
+        } else if (strncmp(argv[i], "-P", 2) == 0) {
+            if (i + 1 < argc && strcmp(argv[i+1], "rgb565") == 0) {
+                lcd_format = LCD_FORMAT_RGB565;
+            } else if (i + 1 >= argc || strcmp(argv[i+1], "argb8888") != 0) {
+                fprintf(stderr, "Please specify argb8888 or rgb565\n");
+                exit(0);
+            }
+            i++;
         } else if (strncmp(&argv[i][strlen(argv[i])-4], ".elf", 3) == 0) {
             elf_file = argv[i];
             // riscv_load_elf(riscv, argv[i]);
@@ -162,8 +279,38 @@ int main(int argc, char** argv) {
         i++;
     }
 
+    // before any device schedules an event against the clock
+    vtime_init(riscv, vtime_mode, vtime_freq, vtime_ipc);
+
+    device_t *lcd = NULL;
+    device_t *blit = NULL;
+    if (has_lcd) {
+        lcd = lcd_create("lcd", 800, 600, lcd_format, is_headless);
+        riscv_add_device(riscv, lcd);
+        if (lcd_capture && lcd_set_capture(lcd, lcd_capture) < 0) {
+            exit(0);
+        }
+        blit = blit_create("blit", BLIT_BASE);
+        riscv_add_device(riscv, blit);
+    }
+
     device_t *usart = usart_create("usart", USART1_BASE);
     riscv_add_device(riscv, usart);
+    if (usart_output && usart_set_output(usart, usart_output) < 0) {
+        exit(0);
+    }
+    if (usart_input && usart_set_input(usart, usart_input) < 0) {
+        exit(0);
+    }
+
+    device_t *logchan = NULL;
+    if (logchan_output) {
+        logchan = logchan_create("logchan", LOGCHAN_BASE);
+        riscv_add_device(riscv, logchan);
+        if (logchan_set_output(logchan, logchan_output) < 0) {
+            exit(0);
+        }
+    }
 
     device_t *pfic = pfic_create("pfic", PFIC_BASE);
     riscv_add_device(riscv, pfic);
@@ -173,7 +320,7 @@ int main(int argc, char** argv) {
     riscv_add_device(riscv, systick);
 
     if (!has_ram) {
-        mem_t *ram = mem_create("ram", MEM_ATTR_READABLE | MEM_ATTR_WRITABLE, RISCV_RAM_BASE, RISCV_RAM_SIZE);
+        ram = mem_create("ram", MEM_ATTR_READABLE | MEM_ATTR_WRITABLE, RISCV_RAM_BASE, RISCV_RAM_SIZE);
         riscv_add_device(riscv, &ram->device);
     }
     
@@ -182,9 +329,28 @@ int main(int argc, char** argv) {
         riscv_add_device(riscv, &flash->device);
         riscv_set_flash(riscv, flash);
     }
+
+    // needs every mem device, and has to alias them before anything is loaded into them
+    if (is_guard) {
+        riscv->guard = guard_create(riscv);
+    }
+
+    if (is_bench) {
+        guard_bench(riscv, ram->device.base, stdout);
+        return 0;
+    }
+
+    // after all devices are added, the jit looks up ram among them
+    if (is_jit) {
+        riscv->jit = jit_create(riscv);
+    }
     
     if (is_run_test) {
         instr_test(riscv);
+        // these build machines of their own
+        if (fuse_test() + blit_test() + lcd_test()) {
+            exit(-1);
+        }
     }
 
     if (has_gdb_server) {
@@ -203,5 +369,23 @@ int main(int argc, char** argv) {
 
     riscv_run(riscv);
 
+    if (is_profile) {
+        usart_flush(usart, USART_FLUSH_EXIT); // keeps the report after the guest output
+        vtime_report(riscv, stdout);
+        usart_report(usart, stdout);
+        if (lcd) {
+            lcd_report(lcd, stdout);
+            blit_report(blit, stdout);
+        }
+        if (logchan) {
+            logchan_drain(logchan, LOGCHAN_DRAIN_EXIT);
+            logchan_report(logchan, stdout);
+        }
+        tier_report(riscv->tier, stdout);
+        riscv_fuse_report(riscv, stdout);
+        mem_report(ram, stdout);
+        mem_report(riscv->flash, stdout);
+    }
+
     return 0;
 }
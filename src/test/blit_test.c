@@ -0,0 +1,257 @@
+#include <string.h>
+#include "test/blit_test.h"
+#include "test/test.h"
+#include "device/blit.h"
+#include "device/lcd.h"
+#include "device/pfic.h"
+
+// ops are driven through the registers as the guest would, on a buffer in ram whose
+// pixels are all different except for every fifth, which holds the key color
+// the result is compared with what the op has to leave in a copy taken before it
+#define BLIT_TEST_BUF       (TEST_RAM_BASE + 0x1000)
+#define BLIT_TEST_BUF_SIZE  0x1000
+#define BLIT_TEST_KEY       0x00c0ffee
+
+typedef struct _blit_case_t {
+    const char *name;
+    blit_reg_t regs;    // src and dst are offsets into the buffer, ctrl is left out
+}blit_case_t;
+
+#define BLIT_CASE(name, op, format, src, src_stride, dst, dst_stride, width, height, color) \
+    {name, {0, 0, op, src, src_stride, dst, dst_stride, width, height, color, format}}
+
+#define ARGB    LCD_FORMAT_ARGB8888
+#define RGB565  LCD_FORMAT_RGB565
+
+static const blit_case_t blit_cases[] = {
+    BLIT_CASE("fill 32", BLIT_OP_FILL, ARGB, 0, 0, 0x104, 64, 5, 3, 0x11223344),
+    BLIT_CASE("fill 16", BLIT_OP_FILL, RGB565, 0, 0, 0x102, 22, 7, 4, 0xabcdbeef),
+    BLIT_CASE("fill 16 one row", BLIT_OP_FILL, RGB565, 0, 0, 0x302, 0, 9, 1, 0x1234),
+    BLIT_CASE("copy 32", BLIT_OP_COPY, ARGB, 0, 64, 0x800, 48, 10, 6, 0),
+    BLIT_CASE("copy 16", BLIT_OP_COPY, RGB565, 0x2, 20, 0x806, 30, 9, 5, 0),
+    BLIT_CASE("copy 32 scroll up", BLIT_OP_COPY, ARGB, 0x40, 64, 0, 64, 16, 15, 0),
+    BLIT_CASE("copy 32 scroll down", BLIT_OP_COPY, ARGB, 0, 64, 0x40, 64, 16, 15, 0),
+    BLIT_CASE("copy 16 scroll up", BLIT_OP_COPY, RGB565, 0x20, 32, 0, 32, 16, 15, 0),
+    BLIT_CASE("copy 16 scroll down", BLIT_OP_COPY, RGB565, 0, 32, 0x20, 32, 16, 15, 0),
+    BLIT_CASE("copy 32 row right", BLIT_OP_COPY, ARGB, 0x100, 0, 0x104, 0, 12, 1, 0),
+    BLIT_CASE("key 32", BLIT_OP_COPY_KEY, ARGB, 0, 64, 0x800, 48, 10, 6, BLIT_TEST_KEY),
+    BLIT_CASE("key 32 down right", BLIT_OP_COPY_KEY, ARGB, 0, 64, 0x44, 64, 8, 8, BLIT_TEST_KEY),
+    BLIT_CASE("key 32 up left", BLIT_OP_COPY_KEY, ARGB, 0x44, 64, 0, 64, 8, 8, BLIT_TEST_KEY),
+    BLIT_CASE("key 32 row right", BLIT_OP_COPY_KEY, ARGB, 0x100, 0, 0x104, 0, 12, 1, BLIT_TEST_KEY),
+    BLIT_CASE("key 32 row left", BLIT_OP_COPY_KEY, ARGB, 0x104, 0, 0x100, 0, 12, 1, BLIT_TEST_KEY),
+    BLIT_CASE("key 16 row right", BLIT_OP_COPY_KEY, RGB565, 0x100, 0, 0x102, 0, 13, 1, BLIT_TEST_KEY),
+    BLIT_CASE("key 16 down right", BLIT_OP_COPY_KEY, RGB565, 0, 32, 0x22, 32, 8, 8, BLIT_TEST_KEY),
+};
+
+// each has to end with ERR and the buffer untouched
+static const blit_case_t blit_bad_cases[] = {
+    BLIT_CASE("width wraps 32", BLIT_OP_FILL, ARGB, 0, 0, 0, 0, 0x40000000, 1, 0),
+    BLIT_CASE("width wraps 16", BLIT_OP_FILL, RGB565, 0, 0, 0, 0, 0x80000000, 1, 0),
+    BLIT_CASE("dst unaligned 32", BLIT_OP_FILL, ARGB, 0, 0, 0x2, 64, 4, 2, 0),
+    BLIT_CASE("dst unaligned 16", BLIT_OP_FILL, RGB565, 0, 0, 0x1, 64, 4, 2, 0),
+    BLIT_CASE("stride unaligned 32", BLIT_OP_FILL, ARGB, 0, 0, 0, 66, 4, 2, 0),
+    BLIT_CASE("stride unaligned 16", BLIT_OP_FILL, RGB565, 0, 0, 0, 33, 4, 2, 0),
+    BLIT_CASE("src unaligned", BLIT_OP_COPY, ARGB, 0x1, 64, 0x800, 64, 4, 2, 0),
+    BLIT_CASE("stride below row", BLIT_OP_FILL, ARGB, 0, 0, 0, 16, 8, 2, 0),
+    BLIT_CASE("overlap with other strides", BLIT_OP_COPY_KEY, ARGB, 0, 64, 0x20, 48, 8, 4, BLIT_TEST_KEY),
+    BLIT_CASE("unknown op", BLIT_OP_NUM, ARGB, 0, 64, 0x800, 64, 4, 2, 0),
+};
+
+static riscv_t *blit_test_machine(void) {
+    riscv_t *riscv = test_machine();
+    riscv_add_device(riscv, blit_create("blit", BLIT_BASE));
+
+    uint8_t *buf = riscv_mem_host(riscv, BLIT_TEST_BUF, BLIT_TEST_BUF_SIZE);
+    for (uint32_t i = 0; i < BLIT_TEST_BUF_SIZE / 4; i++) {
+        uint32_t pixel = i % 5 == 2 ? BLIT_TEST_KEY : 0x01010101 * (i & 0xff) + i;
+        memcpy(buf + i * 4, &pixel, 4);
+    }
+    return riscv;
+}
+
+static uint32_t blit_test_bpp(const blit_reg_t *regs) {
+    return regs->format == LCD_FORMAT_RGB565 ? 2 : 4;
+}
+
+static int blit_test_irq(riscv_t *riscv) {
+    return (riscv->pfic->regs.IPR[BLIT_IRQ / 32] >> (BLIT_IRQ % 32)) & 1;
+}
+
+static uint32_t blit_test_status(riscv_t *riscv) {
+    return riscv_mem_read32(riscv, BLIT_BASE + BLIT_STATUS_OFF);
+}
+
+static void blit_test_start(riscv_t *riscv, const blit_reg_t *regs, riscv_word_t src, riscv_word_t dst, uint32_t ctrl) {
+    riscv_mem_write32(riscv, BLIT_BASE + BLIT_OP_OFF, regs->op);
+    riscv_mem_write32(riscv, BLIT_BASE + BLIT_FORMAT_OFF, regs->format);
+    riscv_mem_write32(riscv, BLIT_BASE + BLIT_SRC_OFF, src);
+    riscv_mem_write32(riscv, BLIT_BASE + BLIT_SRC_STRIDE_OFF, regs->src_stride);
+    riscv_mem_write32(riscv, BLIT_BASE + BLIT_DST_OFF, dst);
+    riscv_mem_write32(riscv, BLIT_BASE + BLIT_DST_STRIDE_OFF, regs->dst_stride);
+    riscv_mem_write32(riscv, BLIT_BASE + BLIT_WIDTH_OFF, regs->width);
+    riscv_mem_write32(riscv, BLIT_BASE + BLIT_HEIGHT_OFF, regs->height);
+    riscv_mem_write32(riscv, BLIT_BASE + BLIT_COLOR_OFF, regs->color);
+    riscv_mem_write32(riscv, BLIT_BASE + BLIT_CTRL_OFF, ctrl | BLIT_CTRL_START);
+}
+
+// runs virtual time to the end of the op, returns its status with DONE and ERR then cleared
+static uint32_t blit_test_finish(riscv_t *riscv) {
+    if (riscv->vtime.deadline != VTIME_NEVER) {
+        vtime_advance(riscv, riscv->vtime.deadline);
+    }
+    uint32_t status = blit_test_status(riscv);
+    riscv_mem_write32(riscv, BLIT_BASE + BLIT_STATUS_OFF, BLIT_STATUS_DONE | BLIT_STATUS_ERR);
+    pfic_clear_irq_pending(riscv->pfic, BLIT_IRQ);
+    return status;
+}
+
+// what the op leaves in the buffer, rows and pixels read from before as if it were a second buffer
+static void blit_test_expect(uint8_t *expect, const uint8_t *before, const blit_reg_t *regs) {
+    uint32_t bpp = blit_test_bpp(regs);
+    uint32_t key = bpp == 2 ? regs->color & 0xffff : regs->color;
+    for (uint32_t y = 0; y < regs->height; y++) {
+        for (uint32_t x = 0; x < regs->width; x++) {
+            uint32_t pixel = regs->color;
+            if (regs->op != BLIT_OP_FILL) {
+                pixel = 0;
+                memcpy(&pixel, before + regs->src + y * regs->src_stride + x * bpp, bpp);
+                if (regs->op == BLIT_OP_COPY_KEY && pixel == key) {
+                    continue;
+                }
+            }
+            memcpy(expect + regs->dst + y * regs->dst_stride + x * bpp, &pixel, bpp);
+        }
+    }
+}
+
+static int blit_test_case(const blit_case_t *c, int bad) {
+    int failed = 0;
+    riscv_t *riscv = blit_test_machine();
+    uint8_t *buf = riscv_mem_host(riscv, BLIT_TEST_BUF, BLIT_TEST_BUF_SIZE);
+    static uint8_t before[BLIT_TEST_BUF_SIZE], expect[BLIT_TEST_BUF_SIZE];
+    memcpy(before, buf, BLIT_TEST_BUF_SIZE);
+    memcpy(expect, buf, BLIT_TEST_BUF_SIZE);
+    if (!bad) {
+        blit_test_expect(expect, before, &c->regs);
+    }
+
+    blit_test_start(riscv, &c->regs, BLIT_TEST_BUF + c->regs.src, BLIT_TEST_BUF + c->regs.dst, 0);
+    uint32_t status = blit_test_finish(riscv);
+    if (bad) {
+        TEST_CHECK(failed, status & BLIT_STATUS_ERR, "%s: no ERR, status %x", c->name, status);
+    } else {
+        TEST_CHECK(failed, status == BLIT_STATUS_DONE, "%s: status %x", c->name, status);
+    }
+    for (uint32_t i = 0; i < BLIT_TEST_BUF_SIZE; i++) {
+        if (buf[i] != expect[i]) {
+            TEST_CHECK(failed, 0, "%s: byte %x is %02x, expected %02x", c->name, i, buf[i], expect[i]);
+            break;
+        }
+    }
+    return failed;
+}
+
+// rects that leave ram, or that would store into flash, are turned away
+static int blit_test_ranges(void) {
+    int failed = 0;
+    riscv_t *riscv = blit_test_machine();
+    blit_reg_t regs = {0};
+    regs.op = BLIT_OP_FILL;
+    regs.width = 16;
+    regs.height = 2;
+    regs.dst_stride = 64;
+    regs.color = 0xdeadbeef;
+
+    riscv_word_t word = riscv_mem_read32(riscv, TEST_FLASH_BASE + 0x100);
+    blit_test_start(riscv, &regs, 0, TEST_FLASH_BASE + 0x100, 0);
+    uint32_t status = blit_test_finish(riscv);
+    TEST_CHECK(failed, status & BLIT_STATUS_ERR, "fill into flash: no ERR, status %x", status);
+    TEST_CHECK(failed, riscv_mem_read32(riscv, TEST_FLASH_BASE + 0x100) == word, "fill into flash: flash written");
+
+    regs.op = BLIT_OP_COPY;
+    regs.src_stride = 64;
+    blit_test_start(riscv, &regs, BLIT_TEST_BUF, TEST_FLASH_BASE + TEST_FLASH_SIZE - 0x80, 0);
+    status = blit_test_finish(riscv);
+    TEST_CHECK(failed, status & BLIT_STATUS_ERR, "copy into flash end: no ERR, status %x", status);
+
+    blit_test_start(riscv, &regs, BLIT_TEST_BUF, TEST_RAM_BASE + TEST_RAM_SIZE - 0x40, 0);
+    status = blit_test_finish(riscv);
+    TEST_CHECK(failed, status & BLIT_STATUS_ERR, "copy past ram end: no ERR, status %x", status);
+
+    // reading flash is fine
+    riscv_mem_write32(riscv, TEST_FLASH_BASE + 0x40, 0x600dc0de);
+    blit_test_start(riscv, &regs, TEST_FLASH_BASE, BLIT_TEST_BUF, 0);
+    status = blit_test_finish(riscv);
+    TEST_CHECK(failed, status == BLIT_STATUS_DONE, "copy from flash: status %x", status);
+    TEST_CHECK(failed, riscv_mem_read32(riscv, BLIT_TEST_BUF + 0x40) == 0x600dc0de, "copy from flash: not copied");
+    return failed;
+}
+
+// BUSY for SETUP + pixels / PIXELS_PER_CYCLE cycles, then DONE and the irq if enabled
+static int blit_test_timing(void) {
+    int failed = 0;
+    riscv_t *riscv = blit_test_machine();
+    blit_reg_t regs = {0};
+    regs.op = BLIT_OP_FILL;
+    regs.width = 64;
+    regs.height = 4;
+    regs.dst_stride = 256;
+    uint64_t cycles = BLIT_SETUP_CYCLES + 64 * 4 / BLIT_PIXELS_PER_CYCLE;
+
+    uint64_t start = vtime_now(riscv);
+    blit_test_start(riscv, &regs, 0, BLIT_TEST_BUF, BLIT_CTRL_IE);
+    uint32_t status = blit_test_status(riscv);
+    TEST_CHECK(failed, status == BLIT_STATUS_BUSY, "timing: status %x after START", status);
+
+    // started again while busy, the running op carries on
+    blit_test_start(riscv, &regs, 0, BLIT_TEST_BUF, BLIT_CTRL_IE);
+    status = blit_test_status(riscv);
+    TEST_CHECK(failed, status == (BLIT_STATUS_BUSY | BLIT_STATUS_ERR), "timing: status %x after a second START", status);
+
+    vtime_advance(riscv, start + cycles - 1);
+    status = blit_test_status(riscv);
+    TEST_CHECK(failed, status & BLIT_STATUS_BUSY, "timing: done a cycle early");
+    TEST_CHECK(failed, !blit_test_irq(riscv), "timing: irq a cycle early");
+
+    vtime_advance(riscv, start + cycles);
+    status = blit_test_status(riscv);
+    TEST_CHECK(failed, status == (BLIT_STATUS_DONE | BLIT_STATUS_ERR), "timing: status %x at the end", status);
+    TEST_CHECK(failed, blit_test_irq(riscv), "timing: no irq %d at the end", BLIT_IRQ);
+    blit_test_finish(riscv);
+
+    // without IE, DONE alone
+    start = vtime_now(riscv);
+    blit_test_start(riscv, &regs, 0, BLIT_TEST_BUF, 0);
+    vtime_advance(riscv, start + cycles);
+    status = blit_test_status(riscv);
+    TEST_CHECK(failed, status == BLIT_STATUS_DONE, "timing: status %x without IE", status);
+    TEST_CHECK(failed, !blit_test_irq(riscv), "timing: irq without IE");
+    blit_test_finish(riscv);
+
+    // a rejected op does nothing, but still takes the setup time
+    regs.dst_stride = 2;
+    start = vtime_now(riscv);
+    blit_test_start(riscv, &regs, 0, BLIT_TEST_BUF, BLIT_CTRL_IE);
+    vtime_advance(riscv, start + BLIT_SETUP_CYCLES - 1);
+    TEST_CHECK(failed, blit_test_status(riscv) & BLIT_STATUS_BUSY, "timing: rejected op done early");
+    vtime_advance(riscv, start + BLIT_SETUP_CYCLES);
+    status = blit_test_status(riscv);
+    TEST_CHECK(failed, status == (BLIT_STATUS_DONE | BLIT_STATUS_ERR), "timing: status %x of a rejected op", status);
+    TEST_CHECK(failed, blit_test_irq(riscv), "timing: no irq for a rejected op");
+    return failed;
+}
+
+// returns the number of failed checks
+int blit_test(void) {
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(blit_cases) / sizeof(blit_cases[0]); i++) {
+        failed += blit_test_case(&blit_cases[i], 0);
+    }
+    for (size_t i = 0; i < sizeof(blit_bad_cases) / sizeof(blit_bad_cases[0]); i++) {
+        failed += blit_test_case(&blit_bad_cases[i], 1);
+    }
+    failed += blit_test_ranges();
+    failed += blit_test_timing();
+    test_report("blit", failed);
+    return failed;
+}
@@ -0,0 +1,6 @@
+#ifndef BLIT_TEST_H
+#define BLIT_TEST_H
+
+int blit_test(void);
+
+#endif
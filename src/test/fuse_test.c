@@ -0,0 +1,276 @@
+#include "test/fuse_test.h"
+#include "test/test.h"
+#include "core/riscv.h"
+
+// each program runs once a step at a time, which never sees fused entries, and once
+// through translated blocks, its loops run long enough for the pairs to get fused,
+// the two runs have to end with the same regs, ram and retired count
+#define FUSE_TEST_STEPS_MAX     100000
+#define FUSE_TEST_RAM_CHECKED   64      // bytes at ram base compared between the runs
+
+#define R_ZERO  0
+#define R_RA    1
+#define R_T0    5
+#define R_T1    6
+#define R_T2    7
+#define R_S0    8
+#define R_A0    10
+#define R_A1    11
+#define R_A2    12
+#define R_A3    13
+#define R_A4    14
+
+#define ENC_R(f3, rd, rs1, rs2) \
+    (((uint32_t)(rs2) << 20) | ((uint32_t)(rs1) << 15) | ((uint32_t)(f3) << 12) | ((uint32_t)(rd) << 7) | OP_R_INSTR)
+#define ENC_I(op, f3, rd, rs1, imm) \
+    ((((uint32_t)(imm) & 0xfff) << 20) | ((uint32_t)(rs1) << 15) | ((uint32_t)(f3) << 12) | ((uint32_t)(rd) << 7) | (op))
+#define ENC_S(f3, rs1, rs2, imm) \
+    ((((uint32_t)(imm) & 0xfe0) << 20) | ((uint32_t)(rs2) << 20) | ((uint32_t)(rs1) << 15) | \
+     ((uint32_t)(f3) << 12) | (((uint32_t)(imm) & 0x1f) << 7) | OP_S_INSTR)
+#define ENC_B(f3, rs1, rs2, imm) \
+    ((((uint32_t)(imm) & 0x1000) << 19) | (((uint32_t)(imm) & 0x7e0) << 20) | ((uint32_t)(rs2) << 20) | \
+     ((uint32_t)(rs1) << 15) | ((uint32_t)(f3) << 12) | (((uint32_t)(imm) & 0x1e) << 7) | \
+     (((uint32_t)(imm) & 0x800) >> 4) | OP_B_INSTR)
+#define ENC_U(op, rd, imm)      (((uint32_t)(imm) & 0xfffff000) | ((uint32_t)(rd) << 7) | (op))
+
+#define LUI(rd, imm)            ENC_U(OP_LUI, rd, imm)
+#define AUIPC(rd, imm)          ENC_U(OP_AUIPC, rd, imm)
+#define JALR(rd, rs1, imm)      ENC_I(OP_JALR, 0, rd, rs1, imm)
+#define ADDI(rd, rs1, imm)      ENC_I(OP_I_ARITH_SHIFT_INSTR, FUNCT3_ADDI, rd, rs1, imm)
+#define ANDI(rd, rs1, imm)      ENC_I(OP_I_ARITH_SHIFT_INSTR, FUNCT3_ANDI, rd, rs1, imm)
+#define SLTI(rd, rs1, imm)      ENC_I(OP_I_ARITH_SHIFT_INSTR, FUNCT3_SLTI, rd, rs1, imm)
+#define SLTIU(rd, rs1, imm)     ENC_I(OP_I_ARITH_SHIFT_INSTR, FUNCT3_SLTIU, rd, rs1, imm)
+#define ADD(rd, rs1, rs2)       ENC_R(FUNCT3_ADD_SUB_MUL, rd, rs1, rs2)
+#define SLT(rd, rs1, rs2)       ENC_R(FUNCT3_SLT_MULHSU, rd, rs1, rs2)
+#define SLTU(rd, rs1, rs2)      ENC_R(FUNCT3_SLTU_MULU, rd, rs1, rs2)
+#define LW(rd, rs1, imm)        ENC_I(OP_I_LOAD_INSTR, FUNCT3_LW, rd, rs1, imm)
+#define SW(rs2, rs1, imm)       ENC_S(FUNCT3_SW, rs1, rs2, imm)
+#define BEQ(rs1, rs2, imm)      ENC_B(FUNCT3_BEQ, rs1, rs2, imm)
+#define BNE(rs1, rs2, imm)      ENC_B(FUNCT3_BNE, rs1, rs2, imm)
+
+typedef struct _fuse_case_t {
+    const char *name;
+    int kind;                   // FUSE_* its pairs run as
+    const riscv_word_t *code;   // loaded at flash base, ends in an ebreak
+    int len;
+}fuse_case_t;
+
+static const riscv_word_t lui_addi_code[] = {
+    ADDI(R_S0, R_ZERO, 64),
+    LUI(R_A0, 0x12345000),      // 4
+    ADDI(R_A0, R_A0, 0x678),
+    ADD(R_A1, R_A1, R_A0),
+    LUI(R_T0, 0xfffff000),
+    ADDI(R_A2, R_T0, -1),       // other rd, negative imm
+    ADD(R_A1, R_A1, R_A2),
+    ADDI(R_S0, R_S0, -1),
+    BNE(R_S0, R_ZERO, -28),     // to 4
+    EBREAK,
+};
+
+// call with rd == rs1, the jalr reads the auipc result and writes the link over it
+static const riscv_word_t auipc_jalr_code[] = {
+    ADDI(R_S0, R_ZERO, 64),
+    AUIPC(R_RA, 0),             // 4
+    JALR(R_RA, R_RA, 12),       // to 16
+    EBREAK,
+    ADD(R_A1, R_A1, R_RA),      // 16
+    AUIPC(R_T1, 0),
+    JALR(R_ZERO, R_T1, 12),     // tail call, to 32
+    EBREAK,
+    ADDI(R_S0, R_S0, -1),       // 32
+    BNE(R_S0, R_ZERO, -32),     // to 4
+    EBREAK,
+};
+
+static const riscv_word_t auipc_addi_code[] = {
+    ADDI(R_S0, R_ZERO, 64),
+    AUIPC(R_A0, 0x1000),        // 4
+    ADDI(R_A0, R_A0, -4),
+    ADD(R_A1, R_A1, R_A0),
+    ADDI(R_S0, R_S0, -1),
+    BNE(R_S0, R_ZERO, -16),     // to 4
+    EBREAK,
+};
+
+static const riscv_word_t auipc_lw_code[] = {
+    ADDI(R_S0, R_ZERO, 64),
+    AUIPC(R_A0, 0),             // 4
+    LW(R_A2, R_A0, 32),         // the word at 36
+    ADD(R_A1, R_A1, R_A2),
+    AUIPC(R_A3, 0),
+    LW(R_A3, R_A3, 20),         // rd == rs1, the word at 36 again
+    ADDI(R_S0, R_S0, -1),
+    BNE(R_S0, R_ZERO, -24),     // to 4
+    EBREAK,
+    0x5aa5c33c,                 // 36
+};
+
+// ram base holds 0x01234567 and 0x89abcdef
+static const riscv_word_t lui_lw_code[] = {
+    ADDI(R_S0, R_ZERO, 64),
+    LUI(R_A0, TEST_RAM_BASE),   // 4
+    LW(R_A2, R_A0, 0),
+    ADD(R_A1, R_A1, R_A2),
+    LUI(R_A3, TEST_RAM_BASE),
+    LW(R_A3, R_A3, 4),          // rd == rs1
+    ADD(R_A1, R_A1, R_A3),
+    ADDI(R_S0, R_S0, -1),
+    BNE(R_S0, R_ZERO, -28),     // to 4
+    EBREAK,
+};
+
+static const riscv_word_t lui_sw_code[] = {
+    ADDI(R_S0, R_ZERO, 64),
+    LUI(R_A0, TEST_RAM_BASE),   // 4
+    SW(R_S0, R_A0, 16),
+    LUI(R_A3, TEST_RAM_BASE),
+    SW(R_A3, R_A3, 20),         // stores the lui result itself
+    ADDI(R_S0, R_S0, -1),
+    BNE(R_S0, R_ZERO, -20),     // to 4
+    EBREAK,
+};
+
+// every compare and branch pairing, each taken on part of the counts
+static const riscv_word_t cmp_branch_code[] = {
+    ADDI(R_S0, R_ZERO, 64),
+    ADDI(R_A4, R_ZERO, 32),
+    SLT(R_T0, R_S0, R_A4),      // 8
+    BEQ(R_T0, R_ZERO, 8),
+    ADDI(R_A1, R_A1, 1),
+    SLT(R_T0, R_S0, R_A4),
+    BNE(R_T0, R_ZERO, 8),
+    ADDI(R_A1, R_A1, 2),
+    SLTU(R_T0, R_A4, R_S0),
+    BEQ(R_T0, R_ZERO, 8),
+    ADDI(R_A1, R_A1, 4),
+    SLTU(R_T0, R_A4, R_S0),
+    BNE(R_T0, R_ZERO, 8),
+    ADDI(R_A1, R_A1, 8),
+    SLTI(R_T0, R_S0, 16),
+    BEQ(R_T0, R_ZERO, 8),
+    ADDI(R_A1, R_A1, 16),
+    SLTI(R_T0, R_S0, 48),
+    BNE(R_T0, R_ZERO, 8),
+    ADDI(R_A1, R_A1, 32),
+    SLTIU(R_T0, R_S0, 8),
+    BEQ(R_T0, R_ZERO, 8),
+    ADDI(R_A1, R_A1, 64),
+    SLTIU(R_T0, R_S0, -1),      // compares against 0xffffffff, always set
+    BNE(R_T0, R_ZERO, 8),
+    ADDI(R_A1, R_A1, 128),
+    ADDI(R_S0, R_S0, -1),
+    BNE(R_S0, R_ZERO, -100),    // to 8
+    EBREAK,
+};
+
+// odd counts jump straight to the branch of a fused pair, which runs alone with the
+// compare result of the lap before, and a pair whose own target is its branch
+static const riscv_word_t cmp_branch_mid_code[] = {
+    ADDI(R_S0, R_ZERO, 64),
+    ANDI(R_T1, R_S0, 1),        // 4
+    BNE(R_T1, R_ZERO, 8),       // to 16
+    SLTI(R_T0, R_S0, 32),
+    BEQ(R_T0, R_ZERO, 8),       // 16, to 24
+    ADDI(R_A1, R_A1, 1),
+    SLTIU(R_T2, R_S0, 0),       // 24, never set
+    BNE(R_T2, R_ZERO, 0),       // to itself, never taken
+    ADDI(R_S0, R_S0, -1),
+    BNE(R_S0, R_ZERO, -32),     // to 4
+    EBREAK,
+};
+
+#define FUSE_CASE(name, kind, code) {name, kind, code, sizeof(code) / sizeof(code[0])}
+
+static const fuse_case_t fuse_cases[] = {
+    FUSE_CASE("lui+addi", FUSE_LUI_ADDI, lui_addi_code),
+    FUSE_CASE("auipc+jalr", FUSE_AUIPC_JALR, auipc_jalr_code),
+    FUSE_CASE("auipc+addi", FUSE_AUIPC_ADDI, auipc_addi_code),
+    FUSE_CASE("auipc+lw", FUSE_AUIPC_LW, auipc_lw_code),
+    FUSE_CASE("lui+lw", FUSE_LUI_LW, lui_lw_code),
+    FUSE_CASE("lui+sw", FUSE_LUI_SW, lui_sw_code),
+    FUSE_CASE("cmp+branch", FUSE_CMP_BRANCH, cmp_branch_code),
+    FUSE_CASE("cmp+branch mid", FUSE_CMP_BRANCH, cmp_branch_mid_code),
+};
+
+static riscv_t *fuse_test_machine(const fuse_case_t *c) {
+    riscv_t *riscv = test_machine();
+    riscv_mem_write(riscv, TEST_FLASH_BASE, (uint8_t *)c->code, c->len * (int)sizeof(riscv_word_t));
+    riscv_mem_write32(riscv, TEST_RAM_BASE, 0x01234567);
+    riscv_mem_write32(riscv, TEST_RAM_BASE + 4, 0x89abcdef);
+    return riscv;
+}
+
+// up to the ebreak through the decode cache, -1 if it never gets there
+static int fuse_test_step(riscv_t *riscv) {
+    for (int i = 0; i < FUSE_TEST_STEPS_MAX; i++) {
+        if (riscv_decode_at(riscv, riscv->pc)->flags & DECODE_STOP) {
+            return 0;
+        }
+        riscv_fetch_and_execute(riscv, 0);
+    }
+    return -1;
+}
+
+static int fuse_test_case(const fuse_case_t *c) {
+    int failed = 0;
+    riscv_t *step = fuse_test_machine(c);
+    riscv_t *block = fuse_test_machine(c);
+    TEST_CHECK(failed, fuse_test_step(step) == 0, "%s: stepped run did not reach ebreak", c->name);
+    riscv_fetch_and_execute(block, 1);
+
+    TEST_CHECK(failed, block->pc == step->pc, "%s: pc %x, stepped %x", c->name, block->pc, step->pc);
+    TEST_CHECK(failed, block->instret == step->instret, "%s: instret %llu, stepped %llu", c->name,
+               (unsigned long long)block->instret, (unsigned long long)step->instret);
+    for (int i = 0; i < RISCV_REGS_NUM; i++) {
+        TEST_CHECK(failed, block->regs[i] == step->regs[i], "%s: x%d %x, stepped %x", c->name, i,
+                   block->regs[i], step->regs[i]);
+    }
+    for (riscv_word_t off = 0; off < FUSE_TEST_RAM_CHECKED; off += sizeof(riscv_word_t)) {
+        riscv_word_t got = riscv_mem_read32(block, TEST_RAM_BASE + off);
+        riscv_word_t want = riscv_mem_read32(step, TEST_RAM_BASE + off);
+        TEST_CHECK(failed, got == want, "%s: ram+%x %x, stepped %x", c->name, off, got, want);
+    }
+
+    TEST_CHECK(failed, block->fuse_stats.sites[c->kind] > 0, "%s: no pair fused", c->name);
+    TEST_CHECK(failed, block->fuse_stats.runs[c->kind] > 0, "%s: no fused pair ran", c->name);
+    TEST_CHECK(failed, step->fuse_stats.runs[c->kind] == 0, "%s: fused pair ran while stepping", c->name);
+    return failed;
+}
+
+// a breakpoint set on the second instr of a pair that already ran fused, the run
+// has to stop there with only the first one done
+static int fuse_test_breakpoint(void) {
+    int failed = 0;
+    riscv_t *riscv = fuse_test_machine(&fuse_cases[0]);
+    riscv_fetch_and_execute(riscv, 1);
+    uint64_t runs = riscv->fuse_stats.runs[FUSE_LUI_ADDI];
+    TEST_CHECK(failed, runs > 0, "breakpoint: lui+addi did not run fused before it was set");
+
+    riscv_add_breakpoint(riscv, TEST_FLASH_BASE + 8);
+    riscv->pc = TEST_FLASH_BASE + 4;
+    riscv->regs[R_A0] = 0;
+    riscv->regs[R_S0] = 1;
+    riscv_fetch_and_execute(riscv, 1);
+    TEST_CHECK(failed, riscv->pc == TEST_FLASH_BASE + 8, "breakpoint: stopped at %x", riscv->pc);
+    TEST_CHECK(failed, riscv->regs[R_A0] == 0x12345000, "breakpoint: a0 %x", riscv->regs[R_A0]);
+    TEST_CHECK(failed, riscv->fuse_stats.runs[FUSE_LUI_ADDI] == runs, "breakpoint: the pair ran fused");
+
+    // and goes on from it once removed
+    riscv_remove_breakpoint(riscv, TEST_FLASH_BASE + 8);
+    riscv_fetch_and_execute(riscv, 1);
+    TEST_CHECK(failed, riscv->pc == TEST_FLASH_BASE + 36, "breakpoint: ended at %x", riscv->pc);
+    TEST_CHECK(failed, riscv->regs[R_A0] == 0x12345678, "breakpoint: a0 %x after removal", riscv->regs[R_A0]);
+    return failed;
+}
+
+// returns the number of failed checks
+int fuse_test(void) {
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(fuse_cases) / sizeof(fuse_cases[0]); i++) {
+        failed += fuse_test_case(&fuse_cases[i]);
+    }
+    failed += fuse_test_breakpoint();
+    test_report("fuse", failed);
+    return failed;
+}
@@ -0,0 +1,6 @@
+#ifndef FUSE_TEST_H
+#define FUSE_TEST_H
+
+int fuse_test(void);
+
+#endif
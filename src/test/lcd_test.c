@@ -0,0 +1,106 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test/lcd_test.h"
+#include "test/test.h"
+#include "device/lcd.h"
+
+// every rgb565 value goes through each conversion kernel the host can run, in runs
+// of 1 to LCD_TEST_RUN_MAX pixels so vector bodies, scalar tails and odd starts all
+// get covered, the results are checked against a channel by channel widening
+#define LCD_TEST_VALUES     65536
+#define LCD_TEST_RUN_MAX    23
+#define LCD_TEST_CANARY     0xdeadbeef
+#define LCD_TEST_TAIL       8   // pixels past the end that must not be written
+
+typedef void (*lcd_convert_fn_t)(uint32_t *dst, const uint16_t *src, int n);
+
+typedef struct _lcd_kernel_t {
+    const char *name;
+    lcd_convert_fn_t fn;
+    int supported;
+}lcd_kernel_t;
+
+// each 5 or 6 bit channel widened to 8 by repeating its top bits
+static uint32_t lcd_test_argb(uint16_t v) {
+    uint32_t r = v >> 11, g = (v >> 5) & 0x3f, b = v & 0x1f;
+    return 0xff000000 | ((r << 3 | r >> 2) << 16) | ((g << 2 | g >> 4) << 8) | (b << 3 | b >> 2);
+}
+
+// n pixels at once, with nothing written past them
+static int lcd_test_tail(const lcd_kernel_t *k, const uint16_t *src, uint32_t *dst, int n) {
+    int failed = 0;
+    for (int i = n; i < n + LCD_TEST_TAIL; i++) {
+        dst[i] = LCD_TEST_CANARY;
+    }
+    k->fn(dst, src, n);
+    for (int i = n; i < n + LCD_TEST_TAIL; i++) {
+        TEST_CHECK(failed, dst[i] == LCD_TEST_CANARY, "%s: n %d wrote pixel %d", k->name, n, i);
+    }
+    TEST_CHECK(failed, dst[n - 1] == lcd_test_argb(src[n - 1]), "%s: n %d missed the last pixel", k->name, n);
+    return failed;
+}
+
+static int lcd_test_kernel(const lcd_kernel_t *k, const uint16_t *src, uint32_t *dst) {
+    int failed = 0;
+
+    memset(dst, 0, (LCD_TEST_VALUES + LCD_TEST_TAIL) * sizeof(uint32_t));
+    int len = 1;
+    for (int i = 0; i < LCD_TEST_VALUES; i += len, len = len % LCD_TEST_RUN_MAX + 1) {
+        k->fn(dst + i, src + i, LCD_TEST_VALUES - i < len ? LCD_TEST_VALUES - i : len);
+    }
+    for (int i = 0; i < LCD_TEST_VALUES; i++) {
+        if (dst[i] != lcd_test_argb(src[i])) {
+            TEST_CHECK(failed, 0, "%s: %04x gave %08x, expected %08x", k->name, src[i], dst[i], lcd_test_argb(src[i]));
+            break;
+        }
+    }
+
+    for (int n = 1; n <= 2 * LCD_TEST_RUN_MAX; n++) {
+        failed += lcd_test_tail(k, src, dst, n);
+    }
+    for (int n = LCD_TEST_VALUES - 2 * LCD_TEST_RUN_MAX; n <= LCD_TEST_VALUES; n++) {
+        failed += lcd_test_tail(k, src, dst, n);
+    }
+    return failed;
+}
+
+// returns the number of failed checks
+int lcd_test(void) {
+    int failed = 0;
+    lcd_kernel_t kernels[] = {
+        {"c", lcd_rgb565_to_argb_c, 1},
+#if defined(__SSE2__)
+        {"sse2", lcd_rgb565_to_argb_sse2, 1},
+        {"avx2", lcd_rgb565_to_argb_avx2, 0},
+#endif
+    };
+#if defined(__SSE2__)
+    __builtin_cpu_init();
+    kernels[2].supported = __builtin_cpu_supports("avx2");
+#endif
+
+    // the values run from an odd index so the vector loads are not all aligned
+    uint16_t *buf = malloc((LCD_TEST_VALUES + 1) * sizeof(uint16_t));
+    uint32_t *dst = malloc((LCD_TEST_VALUES + LCD_TEST_TAIL) * sizeof(uint32_t));
+    if (!buf || !dst) {
+        exit(-1);
+    }
+    uint16_t *src = buf + 1;
+    for (int i = 0; i < LCD_TEST_VALUES; i++) {
+        src[i] = (uint16_t)(i * 40503); // odd, so every value once, in a mixed order
+    }
+
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if (!kernels[i].supported) {
+            fprintf(stdout, "lcd test: %s not supported by the host, skipped\n", kernels[i].name);
+            continue;
+        }
+        failed += lcd_test_kernel(&kernels[i], src, dst);
+    }
+
+    free(buf);
+    free(dst);
+    test_report("lcd", failed);
+    return failed;
+}
@@ -0,0 +1,6 @@
+#ifndef LCD_TEST_H
+#define LCD_TEST_H
+
+int lcd_test(void);
+
+#endif
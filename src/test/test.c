@@ -0,0 +1,34 @@
+#include <stdlib.h>
+#include "test/test.h"
+#include "device/mem.h"
+#include "device/pfic.h"
+
+// flash, ram and the pfic, reset and ready to run from flash base
+riscv_t *test_machine(void) {
+    riscv_t *riscv = riscv_create();
+    if (!riscv) {
+        exit(-1);
+    }
+
+    mem_t *flash = mem_create("flash", MEM_ATTR_READABLE | MEM_ATTR_WRITABLE, TEST_FLASH_BASE, TEST_FLASH_SIZE);
+    mem_t *ram = mem_create("ram", MEM_ATTR_READABLE | MEM_ATTR_WRITABLE, TEST_RAM_BASE, TEST_RAM_SIZE);
+    device_t *pfic = pfic_create("pfic", PFIC_BASE);
+    if (!flash || !ram || !pfic) {
+        exit(-1);
+    }
+    riscv_add_device(riscv, &flash->device);
+    riscv_set_flash(riscv, flash);
+    riscv_add_device(riscv, &ram->device);
+    riscv_add_device(riscv, pfic);
+    riscv_set_pfic(riscv, (pfic_t *)pfic);
+    riscv_reset(riscv);
+    return riscv;
+}
+
+void test_report(const char *name, int failed) {
+    if (failed) {
+        fprintf(stdout, "%s test: %d checks failed\n", name, failed);
+    } else {
+        fprintf(stdout, "%s test: passed\n", name);
+    }
+}
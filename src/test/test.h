@@ -0,0 +1,26 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+#include "core/riscv.h"
+
+// the machine tests run on, laid out like the default one in main, with a smaller flash
+#define TEST_FLASH_BASE     0
+#define TEST_FLASH_SIZE     (64 * 1024)
+#define TEST_RAM_BASE       0x20000000
+#define TEST_RAM_SIZE       (64 * 1024)
+
+// a failed check is reported where it is and counted, the test goes on
+#define TEST_CHECK(failed, cond, ...) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__); \
+            fprintf(stderr, "\n"); \
+            (failed)++; \
+        } \
+    } while (0)
+
+riscv_t *test_machine(void);
+void test_report(const char *name, int failed);
+
+#endif